@@ -0,0 +1,40 @@
+/* Batched environments
+ *
+ * Runs many independent kitchen sessions side by side for automated
+ * players. Every step takes one action per environment and gives back
+ * a reward, a done flag and an observation for each one. Environments
+ * that finish are reset straight away with a fresh seed, so the
+ * observation after a done step is the start of the next session.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct Env_Batch Env_Batch;
+
+// Picks follow a mouse press, drops a mouse release
+typedef enum {
+	ENV_ACTION_NONE,
+	ENV_ACTION_PICK_GENERATOR,                                // + ingredient, 6
+	ENV_ACTION_PICK_FIRE   = ENV_ACTION_PICK_GENERATOR + 6,   // + fire, 2
+	ENV_ACTION_DROP_FIRE   = ENV_ACTION_PICK_FIRE + 2,        // + fire, 2
+	ENV_ACTION_DROP_TABLE  = ENV_ACTION_DROP_FIRE + 2,        // + table, 4
+	ENV_ACTION_DROP_TRASH  = ENV_ACTION_DROP_TABLE + 4,
+	ENV_ACTION_COUNT,
+} Env_Action;
+
+// Per environment, as floats:
+//   per fire:  ingredient (-1 for none), cooking, seconds left to cook
+//   held ingredient (-1 for none)
+//   per table: god (-1 for none), order count, orders bottom first (-1 pads)
+//   seconds to next spawn, seconds between spawns after that
+#define ENV_OBS_SIZE 29
+
+Env_Batch * env_batch_create(int count, float difficulty, float delta_time, uint32_t seed);
+void env_batch_destroy(Env_Batch * batch);
+void env_batch_reset(Env_Batch * batch, int index, uint32_t seed);
+// Any output may be NULL; observations holds count * ENV_OBS_SIZE floats
+void env_batch_step(Env_Batch * batch, const int32_t * actions,
+					float * rewards, uint8_t * dones, float * observations);
+void env_batch_observe(Env_Batch * batch, float * observations);
@@ -0,0 +1,107 @@
+/* Shared-memory environment server protocol
+ *
+ * `game --env-server <name> --envs <n>` creates the POSIX shared memory
+ * object /<name> holding an Env_Shm_Header followed by <n>
+ * Env_Shm_Slots, one per environment. Each slot has two single-producer
+ * single-consumer rings: requests from the client and responses from
+ * the server. Items are filled in place between reserve and commit, and
+ * read in place between peek and release, so nothing is copied and no
+ * locks are taken. Every request gets exactly one response, in order.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "env.h"
+
+#define ENV_SHM_MAGIC     0x4d485344 // "DSHM"
+#define ENV_SHM_VERSION   1
+#define ENV_SHM_RING_SIZE 64 // Power of two
+
+// Request actions are Env_Action values, or this to start a new session
+#define ENV_SHM_RESET -1
+
+typedef struct {
+	int32_t action;
+	// Only read for ENV_SHM_RESET
+	uint32_t seed;
+} Env_Shm_Request;
+
+typedef struct {
+	float reward;
+	uint32_t done;
+	float observation[ENV_OBS_SIZE];
+} Env_Shm_Response;
+
+// Producer and consumer counters on separate cache lines
+typedef struct {
+	uint32_t head;
+	uint8_t pad0[60];
+	uint32_t tail;
+	uint8_t pad1[60];
+} Env_Shm_Ring_Index;
+
+typedef struct {
+	Env_Shm_Ring_Index requests_index;
+	Env_Shm_Request requests[ENV_SHM_RING_SIZE];
+	Env_Shm_Ring_Index responses_index;
+	Env_Shm_Response responses[ENV_SHM_RING_SIZE];
+} Env_Shm_Slot;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t env_count;
+	// Set by the server once the slots are ready, cleared when it stops
+	uint32_t running;
+	// Set by a client to stop the server
+	uint32_t shutdown;
+	uint8_t pad[44];
+} Env_Shm_Header;
+
+static inline Env_Shm_Slot * env_shm_slot(Env_Shm_Header * header, int index)
+{
+	return (Env_Shm_Slot*) (header + 1) + index;
+}
+
+static inline uint32_t env_shm_load(uint32_t * p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void env_shm_store(uint32_t * p, uint32_t value)
+{
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+// reserve/commit on the producer side, peek/release on the consumer
+// side. reserve and peek return NULL when the ring is full or empty.
+#define ENV_SHM_RING(name, type, index, items)									\
+	static inline type * env_shm_##name##_reserve(Env_Shm_Slot * slot)			\
+	{																			\
+		uint32_t head = slot->index.head;										\
+		if (head - env_shm_load(&slot->index.tail) == ENV_SHM_RING_SIZE) {		\
+			return NULL;														\
+		}																		\
+		return &slot->items[head & (ENV_SHM_RING_SIZE - 1)];					\
+	}																			\
+	static inline void env_shm_##name##_commit(Env_Shm_Slot * slot)			\
+	{																			\
+		env_shm_store(&slot->index.head, slot->index.head + 1);				\
+	}																			\
+	static inline type * env_shm_##name##_peek(Env_Shm_Slot * slot)			\
+	{																			\
+		uint32_t tail = slot->index.tail;										\
+		if (tail == env_shm_load(&slot->index.head)) {							\
+			return NULL;														\
+		}																		\
+		return &slot->items[tail & (ENV_SHM_RING_SIZE - 1)];					\
+	}																			\
+	static inline void env_shm_##name##_release(Env_Shm_Slot * slot)			\
+	{																			\
+		env_shm_store(&slot->index.tail, slot->index.tail + 1);				\
+	}
+
+ENV_SHM_RING(request, Env_Shm_Request, requests_index, requests)
+ENV_SHM_RING(response, Env_Shm_Response, responses_index, responses)
@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "jobs.h"
+
+#define JOBS_DEQUE_CAPACITY 256
+#define JOBS_SLEEP_MS        10
+
+struct Job {
+	Job_Function function;
+	void * data;
+	Job_Affinity affinity;
+	Job_Counter * done;
+	// Next in a counter's waiting list
+	Job * next;
+};
+
+// Ring buffer between top and bottom. The owner pushes and pops at the
+// bottom, thieves take from the top. Jobs are coarse enough that a
+// spinlock per deque costs nothing next to running them.
+typedef struct {
+	SDL_SpinLock lock;
+	Job ** items;
+	// Power of two
+	int capacity;
+	int top;
+	int bottom;
+} Job_Deque;
+
+struct Job_System {
+	// Slot 0 is the main thread, then one per worker
+	int slot_count;
+	Job_Deque * deques;
+	Job_Deque main_queue;
+	SDL_Thread ** threads;
+	SDL_threadID main_thread;
+	SDL_atomic_t running;
+	SDL_atomic_t sleeping;
+	SDL_sem * wake;
+};
+
+typedef struct {
+	Job_System * jobs;
+	int slot;
+} Job_Worker_Start;
+
+static _Thread_local Job_System * jobs_current_system;
+static _Thread_local int jobs_current_slot;
+
+static void deque_init(Job_Deque * deque)
+{
+	deque->lock = 0;
+	deque->capacity = JOBS_DEQUE_CAPACITY;
+	deque->items = (Job**) malloc(sizeof(Job*) * deque->capacity);
+	deque->top = 0;
+	deque->bottom = 0;
+}
+
+static void deque_push(Job_Deque * deque, Job * job)
+{
+	SDL_AtomicLock(&deque->lock);
+	if (deque->bottom - deque->top == deque->capacity) {
+		Job ** items = (Job**) malloc(sizeof(Job*) * deque->capacity * 2);
+		for (int i = deque->top; i != deque->bottom; i++) {
+			items[i & (deque->capacity * 2 - 1)] = deque->items[i & (deque->capacity - 1)];
+		}
+		free(deque->items);
+		deque->items = items;
+		deque->capacity *= 2;
+	}
+	deque->items[deque->bottom++ & (deque->capacity - 1)] = job;
+	SDL_AtomicUnlock(&deque->lock);
+}
+
+static Job * deque_pop(Job_Deque * deque)
+{
+	Job * job = NULL;
+	SDL_AtomicLock(&deque->lock);
+	if (deque->bottom != deque->top) {
+		job = deque->items[--deque->bottom & (deque->capacity - 1)];
+	}
+	SDL_AtomicUnlock(&deque->lock);
+	return job;
+}
+
+static Job * deque_steal(Job_Deque * deque)
+{
+	Job * job = NULL;
+	SDL_AtomicLock(&deque->lock);
+	if (deque->bottom != deque->top) {
+		job = deque->items[deque->top++ & (deque->capacity - 1)];
+	}
+	SDL_AtomicUnlock(&deque->lock);
+	return job;
+}
+
+static int jobs_slot(Job_System * jobs)
+{
+	return jobs_current_system == jobs ? jobs_current_slot : 0;
+}
+
+static void jobs_push(Job_System * jobs, Job * job)
+{
+	if (job->affinity == JOB_MAIN_THREAD) {
+		deque_push(&jobs->main_queue, job);
+		return;
+	}
+	deque_push(&jobs->deques[jobs_slot(jobs)], job);
+	if (SDL_AtomicGet(&jobs->sleeping) > 0) {
+		SDL_SemPost(jobs->wake);
+	}
+}
+
+// Own jobs newest first, then the oldest job of each other slot
+static Job * jobs_find(Job_System * jobs, int slot)
+{
+	Job * job = deque_pop(&jobs->deques[slot]);
+	for (int i = 1; !job && i < jobs->slot_count; i++) {
+		job = deque_steal(&jobs->deques[(slot + i) % jobs->slot_count]);
+	}
+	return job;
+}
+
+// Counts down under the lock, so the unlock is the last time the
+// counter is touched; jobs_wait takes the lock once before returning,
+// after which the counter may go out of scope
+static void jobs_counter_finish(Job_System * jobs, Job_Counter * counter)
+{
+	Job * waiting = NULL;
+	SDL_AtomicLock(&counter->lock);
+	if (SDL_AtomicAdd(&counter->pending, -1) == 1) {
+		waiting = counter->waiting;
+		counter->waiting = NULL;
+	}
+	SDL_AtomicUnlock(&counter->lock);
+	while (waiting) {
+		Job * next = waiting->next;
+		jobs_push(jobs, waiting);
+		waiting = next;
+	}
+}
+
+static void jobs_execute(Job_System * jobs, Job * job)
+{
+	job->function(job->data);
+	Job_Counter * done = job->done;
+	free(job);
+	if (done) {
+		jobs_counter_finish(jobs, done);
+	}
+}
+
+static int jobs_worker(void * data)
+{
+	Job_Worker_Start * start = (Job_Worker_Start*) data;
+	Job_System * jobs = start->jobs;
+	int slot = start->slot;
+	free(start);
+	jobs_current_system = jobs;
+	jobs_current_slot = slot;
+	while (SDL_AtomicGet(&jobs->running)) {
+		Job * job = jobs_find(jobs, slot);
+		if (!job) {
+			// Announce the sleep before the last look, so a push that
+			// the look misses is sure to see the sleeper and post
+			SDL_AtomicIncRef(&jobs->sleeping);
+			job = jobs_find(jobs, slot);
+			if (!job) {
+				SDL_SemWaitTimeout(jobs->wake, JOBS_SLEEP_MS);
+			}
+			SDL_AtomicDecRef(&jobs->sleeping);
+		}
+		if (job) {
+			jobs_execute(jobs, job);
+		}
+	}
+	return 0;
+}
+
+Job_System * jobs_create(int workers)
+{
+	if (workers < 0) {
+		workers = SDL_max(SDL_GetCPUCount() - 1, 0);
+	}
+	Job_System * jobs = (Job_System*) calloc(1, sizeof(Job_System));
+	jobs->slot_count = workers + 1;
+	jobs->deques = (Job_Deque*) malloc(sizeof(Job_Deque) * jobs->slot_count);
+	for (int i = 0; i < jobs->slot_count; i++) {
+		deque_init(&jobs->deques[i]);
+	}
+	deque_init(&jobs->main_queue);
+	jobs->main_thread = SDL_ThreadID();
+	SDL_AtomicSet(&jobs->running, 1);
+	SDL_AtomicSet(&jobs->sleeping, 0);
+	jobs->wake = SDL_CreateSemaphore(0);
+	jobs_current_system = jobs;
+	jobs_current_slot = 0;
+
+	jobs->threads = (SDL_Thread**) malloc(sizeof(SDL_Thread*) * workers);
+	for (int i = 0; i < workers; i++) {
+		Job_Worker_Start * start = (Job_Worker_Start*) malloc(sizeof(Job_Worker_Start));
+		start->jobs = jobs;
+		start->slot = i + 1;
+		jobs->threads[i] = SDL_CreateThread(jobs_worker, "job worker", start);
+	}
+	return jobs;
+}
+
+// Jobs still queued are dropped, so wait on everything first
+void jobs_destroy(Job_System * jobs)
+{
+	if (!jobs) return;
+	SDL_AtomicSet(&jobs->running, 0);
+	for (int i = 0; i < jobs->slot_count - 1; i++) {
+		SDL_SemPost(jobs->wake);
+	}
+	for (int i = 0; i < jobs->slot_count - 1; i++) {
+		SDL_WaitThread(jobs->threads[i], NULL);
+	}
+	for (int i = 0; i < jobs->slot_count; i++) {
+		free(jobs->deques[i].items);
+	}
+	free(jobs->main_queue.items);
+	free(jobs->deques);
+	free(jobs->threads);
+	SDL_DestroySemaphore(jobs->wake);
+	if (jobs_current_system == jobs) {
+		jobs_current_system = NULL;
+	}
+	free(jobs);
+}
+
+int jobs_worker_count(Job_System * jobs)
+{
+	return jobs ? jobs->slot_count - 1 : 0;
+}
+
+void jobs_counter_init(Job_Counter * counter)
+{
+	SDL_AtomicSet(&counter->pending, 0);
+	counter->lock = 0;
+	counter->waiting = NULL;
+}
+
+void jobs_run(Job_System * jobs, Job_Function function, void * data,
+			  Job_Affinity affinity, Job_Counter * after, Job_Counter * done)
+{
+	if (!jobs) {
+		function(data);
+		return;
+	}
+	Job * job = (Job*) malloc(sizeof(Job));
+	job->function = function;
+	job->data = data;
+	job->affinity = affinity;
+	job->done = done;
+	job->next = NULL;
+	if (done) {
+		SDL_AtomicIncRef(&done->pending);
+	}
+	if (after) {
+		SDL_AtomicLock(&after->lock);
+		if (SDL_AtomicGet(&after->pending) > 0) {
+			job->next = after->waiting;
+			after->waiting = job;
+			SDL_AtomicUnlock(&after->lock);
+			return;
+		}
+		SDL_AtomicUnlock(&after->lock);
+	}
+	jobs_push(jobs, job);
+}
+
+void jobs_wait(Job_System * jobs, Job_Counter * counter)
+{
+	if (!jobs) return;
+	bool main_thread = SDL_ThreadID() == jobs->main_thread;
+	int slot = jobs_slot(jobs);
+	while (SDL_AtomicGet(&counter->pending) > 0) {
+		Job * job = main_thread ? deque_steal(&jobs->main_queue) : NULL;
+		if (!job) {
+			job = jobs_find(jobs, slot);
+		}
+		if (job) {
+			jobs_execute(jobs, job);
+		} else {
+			SDL_Delay(0);
+		}
+	}
+	SDL_AtomicLock(&counter->lock);
+	SDL_AtomicUnlock(&counter->lock);
+}
+
+void jobs_run_main(Job_System * jobs)
+{
+	if (!jobs) return;
+	Job * job;
+	while ((job = deque_steal(&jobs->main_queue))) {
+		jobs_execute(jobs, job);
+	}
+}
@@ -0,0 +1,56 @@
+/* Work-stealing job system
+ *
+ * Each worker thread owns a deque: it pushes and pops its own jobs at
+ * the bottom, and idle workers steal from the top of the others. The
+ * thread that created the system is slot 0. It has a deque that workers
+ * steal from, plus a queue of jobs that may only run on it, for SDL
+ * calls that have to stay on the render thread. Threads outside the
+ * system push onto slot 0's deque.
+ *
+ * Dependencies go through counters. A job can be held back until a
+ * counter reaches zero, and can count a counter down when it finishes.
+ * Waiting on a counter runs other jobs in the meantime, so it never
+ * deadlocks, even with no worker threads at all.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include <SDL2/SDL.h>
+
+typedef void (*Job_Function)(void * data);
+
+typedef struct Job Job;
+typedef struct Job_System Job_System;
+
+typedef enum {
+	JOB_ANY_THREAD,
+	JOB_MAIN_THREAD,
+} Job_Affinity;
+
+typedef struct {
+	SDL_atomic_t pending;
+	SDL_SpinLock lock;
+	// Jobs waiting for pending to reach zero
+	Job * waiting;
+} Job_Counter;
+
+// workers < 0 means one per core besides the calling thread
+Job_System * jobs_create(int workers);
+void jobs_destroy(Job_System * jobs);
+// Worker threads, not counting the main thread
+int jobs_worker_count(Job_System * jobs);
+
+void jobs_counter_init(Job_Counter * counter);
+
+// Runs function(data) once after is NULL or has reached zero. done, if
+// given, goes up now and back down when the job has finished. With no
+// system the job runs right away on the calling thread.
+void jobs_run(Job_System * jobs, Job_Function function, void * data,
+			  Job_Affinity affinity, Job_Counter * after, Job_Counter * done);
+// Runs other jobs until counter reaches zero. Main thread jobs are only
+// run when called from the main thread.
+void jobs_wait(Job_System * jobs, Job_Counter * counter);
+// Runs every queued main thread job; call once per frame
+void jobs_run_main(Job_System * jobs);
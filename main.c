@@ -1,10 +1,19 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <math.h>
 #include <time.h>
+#include <signal.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
 
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
@@ -12,6 +21,12 @@
 #include <SDL2/SDL_mixer.h>
 
 #include "stretchy_buffer.h"
+#include "rng.h"
+#include "sketch.h"
+#include "env.h"
+#include "env_shm.h"
+#include "jobs.h"
+#include "timer_wheel.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -70,18 +85,45 @@
 #define DEATH_TEXT_X   7
 #define DEATH_TEXT_Y 535
 
+#define TIME_SCALE_TEXT_X 7
+#define TIME_SCALE_TEXT_Y 7
+
 #define MUSIC_SWITCH_RECT ((SDL_Rect) { 262, 544, 30, 30 });
 #define SOUND_SWITCH_RECT ((SDL_Rect) { 306, 544, 30, 30 });
 
 #define SWITCH_ESCAPE_BOX ((SDL_Rect) { 252, 534, 92, 51 });
 // //
 
-static float difficulty;
 #define DIFFICULTY_MULT       2
 #define SUB_BASE_MULT      0.95
 #define SUB_MULT_DIV       20.0
 #define MINIMUM_SPAWN_TIME  6.0
 #define MST_DIV            1.00
+#define SPAWN_FIRST_RESET  10.0
+
+// How quickly gods arrive; copied into every session so sessions
+// can be simulated with different settings side by side
+typedef struct {
+	double difficulty;
+	double sub_base_mult;
+	double sub_mult_div;
+	double minimum_spawn_time;
+	double mst_div;
+} Spawn_Params;
+
+Spawn_Params default_spawn_params(float difficulty)
+{
+	return (Spawn_Params) {
+		difficulty, SUB_BASE_MULT, SUB_MULT_DIV, MINIMUM_SPAWN_TIME, MST_DIV,
+	};
+}
+
+// Time until the spawn after next, given the current one
+float spawn_reset_next(const Spawn_Params * p, float reset)
+{
+	reset *= p->sub_base_mult - (p->difficulty / p->sub_mult_div);
+	return fmax(reset, p->minimum_spawn_time - (p->difficulty / p->mst_div));
+}
 
 typedef struct {
 	int x;
@@ -131,43 +173,452 @@ char * music_paths[MUSIC_COUNT] = {
 };
 
 typedef struct {
+	bool enabled;
 	Mix_Chunk * sounds[SOUND_COUNT];
 	Mix_Music * music[MUSIC_COUNT];
+	// Last music asked for, started once audio is enabled; -1 for none
+	int music_wanted;
 } Sound_State;
 
-static Sound_State sound_state;
+typedef struct {
+	// NULL when rendering headless
+	SDL_Window * window;
+	SDL_Renderer * renderer;
+	float delta_time;
+	uint64_t last_count;
+	// Sampled once per frame, after events are handled
+	int mouse_x;
+	int mouse_y;
+	// Only set when rendering headless
+	SDL_Surface * frame;
+} SDL_State;
+
+// //
+// Engine context
+// Everything one game instance shares between its states. There is no
+// global instance: each one is handed to every state function, so any
+// number of instances can run side by side on different threads.
+typedef struct Overdraw_State Overdraw_State;
 
-static TTF_Font * default_font;
+typedef struct {
+	SDL_State sdl;
+	Sound_State sound;
+	TTF_Font * default_font;
+	float difficulty;
+	// Plays new sessions on integer time, see Playing timers
+	bool fixed_point;
+	// Game seconds per real second, see Time scale
+	float time_scale;
+	bool music_on;
+	bool sound_on;
+	// Allocated the first time the overdraw view is turned on
+	Overdraw_State * overdraw;
+	// Runs loading and other parallel work; NULL runs it all inline
+	Job_System * jobs;
+	// Set by cursor_show, NULL for the system cursor
+	SDL_Cursor * cursor;
+} Engine;
 
-void sound_init()
+// Starts out without a renderer, font or audio, which is all the
+// simulation needs
+void engine_init(Engine * engine)
 {
-	for (int i = 0; i < SOUND_COUNT; i++) {
-		sound_state.sounds[i] = Mix_LoadWAV(sound_paths[i]);
+	memset(engine, 0, sizeof(Engine));
+	engine->difficulty = 0.5;
+	engine->time_scale = 1.0;
+	engine->music_on = true;
+	engine->sound_on = true;
+	engine->sound.music_wanted = -1;
+}
+// //
+
+typedef struct {
+	char * path;
+	Mix_Chunk ** chunk;
+} Sound_Load;
+
+void sound_load_decode(void * data)
+{
+	Sound_Load * load = (Sound_Load*) data;
+	*load->chunk = Mix_LoadWAV(load->path);
+}
+
+// Call once every sound is loaded
+void sound_enable(Engine * engine)
+{
+	engine->sound.enabled = true;
+	if (engine->sound.music_wanted != -1) {
+		Mix_PlayMusic(engine->sound.music[engine->sound.music_wanted], -1);
 	}
-	for (int i = 0; i < MUSIC_COUNT; i++) {
-		sound_state.music[i] = Mix_LoadMUS(music_paths[i]);
+}
+
+// Music that is already playing carries on rather than restarting
+void play_music(Engine * engine, Music music)
+{
+	bool playing = engine->sound.music_wanted == (int) music;
+	engine->sound.music_wanted = music;
+	if (!engine->sound.enabled) return;
+	if (playing && Mix_PlayingMusic()) return;
+	Mix_PlayMusic(engine->sound.music[music], -1);
+}
+
+void play_sound(Engine * engine, Sound sound)
+{
+	if (!engine->sound.enabled) return;
+	Mix_PlayChannel(-1, engine->sound.sounds[sound], 0);
+}
+
+void stop_music(Engine * engine)
+{
+	engine->sound.music_wanted = -1;
+	if (!engine->sound.enabled) return;
+	Mix_HaltMusic();
+}
+
+// //
+// Headless rendering
+// Draws into a plain surface through SDL's software renderer instead of
+// a window, so frames can be produced without a display, audio or GPU.
+// The frame advances by a fixed step so output is deterministic.
+#define HEADLESS_DELTA_TIME (1.0 / 60.0)
+
+SDL_Renderer * headless_renderer_create(Engine * engine)
+{
+	engine->sdl.frame = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32,
+													   SDL_PIXELFORMAT_ARGB8888);
+	if (!engine->sdl.frame) {
+		return NULL;
+	}
+	return SDL_CreateSoftwareRenderer(engine->sdl.frame);
+}
+
+bool headless_init(Engine * engine)
+{
+	SDL_Init(SDL_INIT_EVENTS);
+	TTF_Init();
+	engine->default_font = TTF_OpenFont("resources/EBGaramond12-AllSC.ttf", UI_FONT_SIZE);
+	engine->sdl.renderer = headless_renderer_create(engine);
+	if (!engine->sdl.renderer) {
+		fprintf(stderr, "Could not create headless renderer: %s\n", SDL_GetError());
+		return false;
+	}
+	SDL_SetRenderDrawBlendMode(engine->sdl.renderer, SDL_BLENDMODE_BLEND);
+	engine->sdl.delta_time = HEADLESS_DELTA_TIME;
+	return true;
+}
+// //
+
+// //
+// Overdraw debug view
+// Counts how many times each screen pixel gets written during a
+// frame. Toggled with F1; drawn as a heatmap over the frame.
+#define OVERDRAW_TOGGLE_KEY SDL_SCANCODE_F1
+
+struct Overdraw_State {
+	bool enabled;
+	uint16_t counts[SCREEN_WIDTH * SCREEN_HEIGHT];
+	uint32_t heat[SCREEN_WIDTH * SCREEN_HEIGHT];
+	SDL_Texture * texture;
+};
+
+void overdraw_toggle(Engine * engine)
+{
+	if (!engine->overdraw) {
+		engine->overdraw = (Overdraw_State*) calloc(1, sizeof(Overdraw_State));
+	}
+	engine->overdraw->enabled = !engine->overdraw->enabled;
+	memset(engine->overdraw->counts, 0, sizeof(engine->overdraw->counts));
+}
+
+bool overdraw_enabled(Engine * engine)
+{
+	return engine->overdraw && engine->overdraw->enabled;
+}
+
+void overdraw_count_rect(Overdraw_State * overdraw, const SDL_Rect * rect)
+{
+	SDL_Rect screen = make_SDL_Rect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+	SDL_Rect clipped;
+	if (!rect) {
+		clipped = screen;
+	} else if (!SDL_IntersectRect(rect, &screen, &clipped)) {
+		return;
+	}
+	for (int y = clipped.y; y < clipped.y + clipped.h; y++) {
+		uint16_t * row = overdraw->counts + y * SCREEN_WIDTH;
+		for (int x = clipped.x; x < clipped.x + clipped.w; x++) {
+			row[x]++;
+		}
+	}
+}
+
+void overdraw_count_line(Overdraw_State * overdraw, int x1, int y1, int x2, int y2)
+{
+	int dx = abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
+	int dy = -abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
+	int err = dx + dy;
+	while (true) {
+		if (x1 >= 0 && x1 < SCREEN_WIDTH && y1 >= 0 && y1 < SCREEN_HEIGHT) {
+			overdraw->counts[y1 * SCREEN_WIDTH + x1]++;
+		}
+		if (x1 == x2 && y1 == y2) break;
+		int e2 = 2 * err;
+		if (e2 >= dy) { err += dy; x1 += sx; }
+		if (e2 <= dx) { err += dx; y1 += sy; }
+	}
+}
+
+// All drawing in the states goes through these so overdraw can be
+// counted in one place
+int render_copy(Engine * engine, SDL_Texture * texture, const SDL_Rect * src, const SDL_Rect * dst)
+{
+	if (overdraw_enabled(engine)) {
+		overdraw_count_rect(engine->overdraw, dst);
+	}
+	return SDL_RenderCopy(engine->sdl.renderer, texture, src, dst);
+}
+
+int render_draw_line(Engine * engine, int x1, int y1, int x2, int y2)
+{
+	if (overdraw_enabled(engine)) {
+		overdraw_count_line(engine->overdraw, x1, y1, x2, y2);
+	}
+	return SDL_RenderDrawLine(engine->sdl.renderer, x1, y1, x2, y2);
+}
+
+int render_clear(Engine * engine)
+{
+	if (overdraw_enabled(engine)) {
+		overdraw_count_rect(engine->overdraw, NULL);
+	}
+	return SDL_RenderClear(engine->sdl.renderer);
+}
+// //
+
+// //
+// Input filter
+// An SDL event filter drops input nobody will look at before it reaches
+// the queue, so a 1000 Hz mouse costs nothing per frame. Each state says
+// which classes of input it handles with input_want; everything that
+// isn't input, like quitting and window events, always gets through.
+// SDL updates the mouse position before filtering, so
+// SDL_GetMouseState stays current with motion dropped. When motion is
+// wanted, it's coalesced: while one motion event is waiting in the
+// queue, further ones are dropped.
+typedef enum {
+	INPUT_MOUSE_BUTTONS = 1 << 0,
+	INPUT_MOUSE_MOTION  = 1 << 1,
+	INPUT_MOUSE_WHEEL   = 1 << 2,
+	INPUT_KEY_DOWN      = 1 << 3,
+	INPUT_KEY_UP        = 1 << 4,
+	INPUT_TEXT          = 1 << 5,
+	INPUT_TOUCH         = 1 << 6,
+	INPUT_CONTROLLER    = 1 << 7,
+} Input_Class;
+
+// The debug keys main handles in every state
+#define ENGINE_INPUT INPUT_KEY_DOWN
+
+static SDL_atomic_t input_wanted;
+static SDL_atomic_t input_motion_queued;
+
+// 0 for events that aren't input
+Input_Class input_class(uint32_t type)
+{
+	switch (type) {
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		return INPUT_MOUSE_BUTTONS;
+	case SDL_MOUSEMOTION:
+		return INPUT_MOUSE_MOTION;
+	case SDL_MOUSEWHEEL:
+		return INPUT_MOUSE_WHEEL;
+	case SDL_KEYDOWN:
+		return INPUT_KEY_DOWN;
+	case SDL_KEYUP:
+		return INPUT_KEY_UP;
+	case SDL_TEXTEDITING:
+	case SDL_TEXTINPUT:
+		return INPUT_TEXT;
+	case SDL_FINGERDOWN:
+	case SDL_FINGERUP:
+	case SDL_FINGERMOTION:
+	case SDL_DOLLARGESTURE:
+	case SDL_DOLLARRECORD:
+	case SDL_MULTIGESTURE:
+		return INPUT_TOUCH;
+	}
+	if (type >= SDL_JOYAXISMOTION && type < SDL_FINGERDOWN) {
+		return INPUT_CONTROLLER;
+	}
+	return 0;
+}
+
+// Runs on whichever thread SDL pushes the event from
+int input_filter(void * data, SDL_Event * event)
+{
+	Input_Class class = input_class(event->type);
+	if (class == 0) return 1;
+	if (!(SDL_AtomicGet(&input_wanted) & class)) return 0;
+	if (class == INPUT_MOUSE_MOTION) {
+		return SDL_AtomicCAS(&input_motion_queued, 0, 1);
 	}
+	return 1;
 }
 
-void play_music(Music music)
+void input_filter_install()
 {
-	Mix_PlayMusic(sound_state.music[music], -1);
+	SDL_AtomicSet(&input_wanted, ENGINE_INPUT);
+	SDL_AtomicSet(&input_motion_queued, 0);
+	SDL_SetEventFilter(input_filter, NULL);
 }
 
-void play_sound(Sound sound)
+// Replaces the classes let through. Input already queued stays there.
+void input_want(uint32_t classes)
 {
-	Mix_PlayChannel(-1, sound_state.sounds[sound], 0);
+	SDL_AtomicSet(&input_wanted, ENGINE_INPUT | classes);
 }
 
+// Call for every event taken off the queue
+void input_dequeued(SDL_Event event)
+{
+	if (event.type == SDL_MOUSEMOTION) {
+		SDL_AtomicSet(&input_motion_queued, 0);
+	}
+}
+// //
+
+// //
+// Input latency
+// With --latency, every mouse press and release handed to State_Playing
+// is timed from its SDL timestamp to the first present of a frame that
+// was simulated after handling it, and the distributions are printed on
+// exit. SDL timestamps are whole milliseconds, so the wait in the event
+// queue is only good to a millisecond; everything after is timed with
+// the performance counter. Whatever the display adds after the present
+// isn't seen.
+#define LATENCY_PENDING 64
+
+typedef enum {
+	LATENCY_PRESS,
+	LATENCY_RELEASE,
+	LATENCY_KINDS,
+} Latency_Kind;
+
 typedef struct {
-	SDL_Renderer * renderer;
-	float delta_time;
-	uint64_t last_count;
-} SDL_State;
+	uint32_t serial;
+	Latency_Kind kind;
+	double queued_ms;
+	uint64_t dispatched;
+} Latency_Input;
+
+typedef struct {
+	bool enabled;
+	// Ring of inputs not yet shown
+	Latency_Input pending[LATENCY_PENDING];
+	int first;
+	int count;
+	// Inputs sent to the state, and inputs handled in the last frame drawn
+	uint32_t sent;
+	uint32_t shown;
+	// Event to dispatch, dispatch to present, and the two together
+	Quantile_Sketch queued[LATENCY_KINDS];
+	Quantile_Sketch handled[LATENCY_KINDS];
+	Quantile_Sketch total[LATENCY_KINDS];
+	int dropped;
+} Input_Latency;
+
+static Input_Latency input_latency;
+
+void latency_enable()
+{
+	input_latency.enabled = true;
+	for (int k = 0; k < LATENCY_KINDS; k++) {
+		sketch_init(&input_latency.queued[k]);
+		sketch_init(&input_latency.handled[k]);
+		sketch_init(&input_latency.total[k]);
+	}
+}
+
+// Call when a new State_Playing starts counting inputs from zero
+void latency_begin()
+{
+	input_latency.count = 0;
+	input_latency.sent = 0;
+	input_latency.shown = 0;
+}
+
+// Call as event is handed to State_Playing
+void latency_input(SDL_Event event)
+{
+	if (!input_latency.enabled) return;
+	if (event.type != SDL_MOUSEBUTTONDOWN && event.type != SDL_MOUSEBUTTONUP) return;
+	uint32_t serial = ++input_latency.sent;
+	if (input_latency.count == LATENCY_PENDING) {
+		input_latency.dropped++;
+		return;
+	}
+	Latency_Input * input =
+		&input_latency.pending[(input_latency.first + input_latency.count++) % LATENCY_PENDING];
+	input->serial = serial;
+	input->kind = event.type == SDL_MOUSEBUTTONDOWN ? LATENCY_PRESS : LATENCY_RELEASE;
+	input->queued_ms = (double) (SDL_GetTicks() - event.button.timestamp);
+	input->dispatched = SDL_GetPerformanceCounter();
+}
+
+// Call when drawing a frame, with the inputs its state had handled
+void latency_shown(uint32_t serial)
+{
+	input_latency.shown = serial;
+}
+
+// Call right after SDL_RenderPresent
+void latency_presented()
+{
+	if (!input_latency.enabled) return;
+	uint64_t now = SDL_GetPerformanceCounter();
+	double frequency = (double) SDL_GetPerformanceFrequency();
+	while (input_latency.count > 0) {
+		Latency_Input * input = &input_latency.pending[input_latency.first];
+		if (input->serial > input_latency.shown) break;
+		double handled_ms = (now - input->dispatched) * 1000.0 / frequency;
+		sketch_add(&input_latency.queued[input->kind], input->queued_ms);
+		sketch_add(&input_latency.handled[input->kind], handled_ms);
+		sketch_add(&input_latency.total[input->kind], input->queued_ms + handled_ms);
+		input_latency.first = (input_latency.first + 1) % LATENCY_PENDING;
+		input_latency.count--;
+	}
+}
 
-static SDL_State sdl_state;
+void latency_report()
+{
+	if (!input_latency.enabled) return;
+	char * kind_names[LATENCY_KINDS] = { "press", "release" };
+	char * stage_names[3] = { "queued", "to present", "total" };
+	fprintf(stderr, "Input to present latency, ms\n");
+	fprintf(stderr, "%-8s %-11s %7s %7s %7s %7s %7s %7s\n",
+			"input", "stage", "count", "mean", "p50", "p90", "p99", "max");
+	for (int k = 0; k < LATENCY_KINDS; k++) {
+		Quantile_Sketch * stages[3] = {
+			&input_latency.queued[k], &input_latency.handled[k], &input_latency.total[k],
+		};
+		for (int i = 0; i < 3; i++) {
+			Quantile_Sketch * sketch = stages[i];
+			if (sketch->count == 0) continue;
+			fprintf(stderr, "%-8s %-11s %7llu %7.1f %7.1f %7.1f %7.1f %7.1f\n",
+					kind_names[k], stage_names[i], (unsigned long long) sketch->count,
+					sketch_mean(sketch), sketch_quantile(sketch, 0.50),
+					sketch_quantile(sketch, 0.90), sketch_quantile(sketch, 0.99), sketch->max);
+		}
+	}
+	if (input_latency.dropped > 0) {
+		fprintf(stderr, "%d inputs not timed, too many waiting\n", input_latency.dropped);
+	}
+}
+// //
 
 #define COOK_TIME 3.0
+#define ORDER_MAX 3
 typedef enum {
 	INGRED_NONE = -1,
 	
@@ -229,7 +680,7 @@ char * god_texture_paths[GOD_COUNT] = {
 	"resources/anansi.png",
 };
 
-void god_eating_sound(God god)
+void god_eating_sound(Engine * engine, God god)
 {
 	switch (god) {
 	case GOD_ZEUS:
@@ -237,30 +688,126 @@ void god_eating_sound(God god)
 	case GOD_ANUBIS:
 	case GOD_ODIN:
 	case GOD_RA:
-		play_sound(SOUND_EAT_LOW);
+		play_sound(engine, SOUND_EAT_LOW);
 		break;
 	case GOD_POSEIDON:
 	case GOD_JESUS:
 	case GOD_ANANSI:
-		play_sound(SOUND_EAT_MED);
+		play_sound(engine, SOUND_EAT_MED);
 		break;
 	case GOD_VENUS:
-		play_sound(SOUND_EAT_HIGH);
+		play_sound(engine, SOUND_EAT_HIGH);
 		break;
 	}
 }
 
-SDL_Texture * load_texture_from_path(char * path)
+// One texture of a batch. The image is decoded on any thread, then the
+// texture is created on the main thread, which owns the renderer.
+typedef struct {
+	Engine * engine;
+	char path[256];
+	SDL_Texture ** texture;
+	// Also made into a cursor_size square cursor when set, see cursor_show
+	SDL_Cursor ** cursor;
+	int cursor_size;
+	unsigned char * pixels;
+	int w;
+	int h;
+	Job_Counter decoded;
+} Texture_Load;
+
+void texture_load_decode(void * data)
+{
+	Texture_Load * load = (Texture_Load*) data;
+	int n;
+	load->pixels = stbi_load(load->path, &load->w, &load->h, &n, 4);
+	assert(load->pixels);
+}
+
+// Cursors need a window, so headless runs and exports get none and keep
+// drawing sprites
+SDL_Cursor * cursor_from_surface(SDL_Surface * surface, int size)
+{
+	if (!SDL_WasInit(SDL_INIT_VIDEO)) return NULL;
+	SDL_Surface * scaled = SDL_CreateRGBSurfaceWithFormat(0, size, size, 32, SDL_PIXELFORMAT_RGBA32);
+	if (!scaled) return NULL;
+	// Copy alpha as is rather than blending onto nothing
+	SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+	SDL_BlitScaled(surface, NULL, scaled, NULL);
+	SDL_Cursor * cursor = SDL_CreateColorCursor(scaled, size / 2, size / 2);
+	SDL_FreeSurface(scaled);
+	return cursor;
+}
+
+void texture_load_upload(void * data)
 {
-	int w, h, n;
-	unsigned char * data = stbi_load(path, &w, &h, &n, 4);
-	assert(data);
-	SDL_Surface * surface = SDL_CreateRGBSurfaceFrom(data, w, h, 4 * 8, w * 4,
+	Texture_Load * load = (Texture_Load*) data;
+	SDL_Surface * surface = SDL_CreateRGBSurfaceFrom(load->pixels, load->w, load->h, 4 * 8, load->w * 4,
 													 0x000000ff, 0x0000ff00,
 													 0x00ff0000, 0xff000000);
-	SDL_Texture * texture = SDL_CreateTextureFromSurface(sdl_state.renderer, surface);
+	*load->texture = SDL_CreateTextureFromSurface(load->engine->sdl.renderer, surface);
+	if (load->cursor) {
+		*load->cursor = cursor_from_surface(surface, load->cursor_size);
+	}
 	SDL_FreeSurface(surface);
-	return texture;
+	stbi_image_free(load->pixels);
+	load->pixels = NULL;
+	// Draw it once, so drivers that upload lazily do it now instead of
+	// on the first frame that shows it. Uploads happen before the
+	// frame is cleared.
+	SDL_Rect warm = make_SDL_Rect(0, 0, 1, 1);
+	SDL_RenderCopy(load->engine->sdl.renderer, *load->texture, NULL, &warm);
+}
+
+void texture_load_add(Texture_Load ** loads, SDL_Texture ** texture, char * path)
+{
+	Texture_Load * load = sb_add(*loads, 1);
+	snprintf(load->path, sizeof(load->path), "%s", path);
+	load->texture = texture;
+	load->cursor = NULL;
+}
+
+// Cursors are made at their size in game pixels, so they only match
+// what is drawn while the window shows the game unscaled, which a
+// resizable --render-scale window need not
+bool cursor_fits(Engine * engine)
+{
+	if (!engine->sdl.window) return false;
+	int w, h;
+	SDL_GetWindowSize(engine->sdl.window, &w, &h);
+	return w == SCREEN_WIDTH && h == SCREEN_HEIGHT;
+}
+
+// Shows cursor in place of the system one, or the system one for NULL
+void cursor_show(Engine * engine, SDL_Cursor * cursor)
+{
+	if (cursor == engine->cursor) return;
+	SDL_SetCursor(cursor ? cursor : SDL_GetDefaultCursor());
+	engine->cursor = cursor;
+}
+
+// Queues the whole batch to be decoded in parallel once after (if
+// given) reaches zero. Each texture is uploaded as soon as its image is
+// ready, counting down uploaded. loads must stay put until then.
+void load_textures_start(Engine * engine, Texture_Load * loads, Job_Counter * after, Job_Counter * uploaded)
+{
+	for (int i = 0; i < sb_count(loads); i++) {
+		Texture_Load * load = &loads[i];
+		load->engine = engine;
+		jobs_counter_init(&load->decoded);
+		jobs_run(engine->jobs, texture_load_decode, load, JOB_ANY_THREAD, after, &load->decoded);
+		jobs_run(engine->jobs, texture_load_upload, load, JOB_MAIN_THREAD, &load->decoded, uploaded);
+	}
+}
+
+// Loads and frees the batch
+void load_textures(Engine * engine, Texture_Load * loads)
+{
+	Job_Counter uploaded;
+	jobs_counter_init(&uploaded);
+	load_textures_start(engine, loads, NULL, &uploaded);
+	jobs_wait(engine->jobs, &uploaded);
+	sb_free(loads);
 }
 
 typedef enum {
@@ -269,9 +816,6 @@ typedef enum {
 	MAIN_MENU_QUIT,
 } Main_Menu_Msg;
 
-static bool music_on = true;
-static bool sound_on = true;
-
 typedef struct {
 	SDL_Texture * bg;
 	SDL_Texture * slider_texture;
@@ -284,6 +828,8 @@ typedef struct {
 	float slider;
 	bool clicked_this_frame;
 	bool sliding;
+	// Set when the screen has to be drawn again without any input
+	bool redraw;
 } State_Main_Menu;
 
 SDL_Rect slider_box(State_Main_Menu * state)
@@ -294,23 +840,64 @@ SDL_Rect slider_box(State_Main_Menu * state)
 	};
 }
 
-void state_main_menu_init(State_Main_Menu * state)
+Texture_Load * state_main_menu_texture_loads(State_Main_Menu * state)
 {
-	play_music(MUSIC_MENU);
-	state->bg = load_texture_from_path("resources/title.png");
-	state->slider_texture = load_texture_from_path("resources/slider.png");
+	Texture_Load * loads = NULL;
+	texture_load_add(&loads, &state->bg, "resources/title.png");
+	texture_load_add(&loads, &state->slider_texture, "resources/slider.png");
 
-	state->music_on_texture = load_texture_from_path("resources/music.png");
-	state->music_off_texture = load_texture_from_path("resources/music-off.png");
-	state->sound_on_texture = load_texture_from_path("resources/sound.png");
-	state->sound_off_texture = load_texture_from_path("resources/sound-off.png");
+	texture_load_add(&loads, &state->music_on_texture, "resources/music.png");
+	texture_load_add(&loads, &state->music_off_texture, "resources/music-off.png");
+	texture_load_add(&loads, &state->sound_on_texture, "resources/sound.png");
+	texture_load_add(&loads, &state->sound_off_texture, "resources/sound-off.png");
+	return loads;
+}
+
+void state_main_menu_load_textures(Engine * engine, State_Main_Menu * state)
+{
+	load_textures(engine, state_main_menu_texture_loads(state));
+}
 
+// Textures are loaded separately, see Asset streaming
+void state_main_menu_init(Engine * engine, State_Main_Menu * state)
+{
+	play_music(engine, MUSIC_MENU);
 	state->slider = 1.0;
 	state->clicked_this_frame = false;
 	state->sliding = false;
+	state->redraw = true;
+}
+
+// The button release that ends a drag may go to the state on top, so
+// input in progress is dropped while suspended
+void state_main_menu_suspend(Engine * engine, State_Main_Menu * state)
+{
+	state->clicked_this_frame = false;
+	state->sliding = false;
+}
+
+// The slider keeps its position; only the music has to come back
+void state_main_menu_resume(Engine * engine, State_Main_Menu * state)
+{
+	play_music(engine, MUSIC_MENU);
+	state->redraw = true;
+}
+
+// Nothing moves on the menu unless it's given input or the slider is
+// being dragged, so an idle menu doesn't have to be drawn again. main
+// then sleeps until there are events, waking up every
+// MENU_IDLE_TIMEOUT_MS regardless.
+#define MENU_IDLE_TIMEOUT_MS 500
+
+bool state_main_menu_idle(State_Main_Menu * state)
+{
+	return !state->redraw && !state->clicked_this_frame && !state->sliding;
 }
 
-void state_main_menu_event(State_Main_Menu * state, SDL_Event event)
+// See Input filter
+#define MAIN_MENU_INPUT INPUT_MOUSE_BUTTONS
+
+void state_main_menu_event(Engine * engine, State_Main_Menu * state, SDL_Event event)
 {
 	switch (event.type) {
 	case SDL_MOUSEBUTTONDOWN: {
@@ -327,10 +914,9 @@ float fclamp(float k, float lower, float upper)
 	return fmin(upper, fmax(lower, k));
 }
 
-Main_Menu_Msg state_main_menu_update(State_Main_Menu * state)
+Main_Menu_Msg state_main_menu_update(Engine * engine, State_Main_Menu * state)
 {
-	int mx, my;
-	uint32_t mask = SDL_GetMouseState(&mx, &my);
+	int mx = engine->sdl.mouse_x, my = engine->sdl.mouse_y;
 	SDL_Point point = (SDL_Point) {mx, my};
 	if (state->clicked_this_frame) {
 		// Play/Quit buttons
@@ -355,23 +941,23 @@ Main_Menu_Msg state_main_menu_update(State_Main_Menu * state)
 		// Sound / Music
 		SDL_Rect music_rect = MUSIC_SWITCH_RECT;
 		if (SDL_PointInRect(&point, &music_rect)) {
-			if (music_on) {
+			if (engine->music_on) {
 				Mix_VolumeMusic(0);
-				music_on = false;
+				engine->music_on = false;
 			} else {
 				Mix_VolumeMusic(MIX_MAX_VOLUME);
-				music_on = true;
+				engine->music_on = true;
 			}
 		}
 		SDL_Rect sound_rect = SOUND_SWITCH_RECT;
 		if (SDL_PointInRect(&point, &sound_rect)) {
 			int volume;
-			if (sound_on) {
+			if (engine->sound_on) {
 				volume = 0;
-				sound_on = false;
+				engine->sound_on = false;
 			} else {
 				volume = MIX_MAX_VOLUME;
-				sound_on = true;
+				engine->sound_on = true;
 			}
 			int channels = Mix_AllocateChannels(-1);
 			for (int i = 0; i < channels; i++) {
@@ -386,58 +972,63 @@ Main_Menu_Msg state_main_menu_update(State_Main_Menu * state)
 		state->slider = roundf(state->slider * 10) / 10;
 	}
 	// Update difficulty through slider
-	difficulty = (1.0 - state->slider) * (DIFFICULTY_MULT - 1.0) + 1.0;
+	engine->difficulty = (1.0 - state->slider) * (DIFFICULTY_MULT - 1.0) + 1.0;
 	return MAIN_MENU_NOTHING;
 }
 
-SDL_Texture * render_text(char * text, SDL_Color color, int * w, int * h) 
+SDL_Texture * render_text(Engine * engine, char * text, SDL_Color color, int * w, int * h) 
 {
-	SDL_Surface * surface = TTF_RenderText_Solid(default_font, text, color);
+	SDL_Surface * surface = TTF_RenderText_Solid(engine->default_font, text, color);
 	*w = surface->w;
 	*h = surface->h;
-	SDL_Texture * texture = SDL_CreateTextureFromSurface(sdl_state.renderer, surface);
+	SDL_Texture * texture = SDL_CreateTextureFromSurface(engine->sdl.renderer, surface);
 	SDL_FreeSurface(surface);
 	return texture;
 }
 
-void state_main_menu_render(State_Main_Menu * state)
+void state_main_menu_render(Engine * engine, State_Main_Menu * state)
 {
-	SDL_RenderCopy(sdl_state.renderer, state->bg, NULL, NULL);
+	state->redraw = false;
+	render_copy(engine, state->bg, NULL, NULL);
 	SDL_Rect slider_rect = slider_box(state);
-	SDL_RenderCopy(sdl_state.renderer, state->slider_texture, NULL, &slider_rect);
+	render_copy(engine, state->slider_texture, NULL, &slider_rect);
 	// Render difficulty text
 	{
 		char buffer[512];
-		sprintf(buffer, "%.1f", difficulty);
+		sprintf(buffer, "%.1f", engine->difficulty);
 		int w, h;
-		SDL_Texture * texture = render_text(buffer, (SDL_Color) { 0xff, 0xff, 0xff, 0xff }, &w, &h);
+		SDL_Texture * texture = render_text(engine, buffer, (SDL_Color) { 0xff, 0xff, 0xff, 0xff }, &w, &h);
 		SDL_Rect rect = (SDL_Rect) { UI_DIFF_TEXT_X, UI_DIFF_TEXT_Y, w, h };
-		SDL_RenderCopy(sdl_state.renderer, texture, NULL, &rect);
+		render_copy(engine, texture, NULL, &rect);
 		SDL_DestroyTexture(texture);
 	}
 	// Sound/music switches
 	{
-		SDL_Texture * music_tex = music_on ? state->music_on_texture : state->music_off_texture;
+		SDL_Texture * music_tex = engine->music_on ? state->music_on_texture : state->music_off_texture;
 		SDL_Rect music_rect = MUSIC_SWITCH_RECT;
-		SDL_RenderCopy(sdl_state.renderer, music_tex, NULL, &music_rect);
+		render_copy(engine, music_tex, NULL, &music_rect);
 
-		SDL_Texture * sound_tex = sound_on ? state->sound_on_texture : state->sound_off_texture;
+		SDL_Texture * sound_tex = engine->sound_on ? state->sound_on_texture : state->sound_off_texture;
 		SDL_Rect sound_rect = SOUND_SWITCH_RECT;
-		SDL_RenderCopy(sdl_state.renderer, sound_tex, NULL, &sound_rect);
+		render_copy(engine, sound_tex, NULL, &sound_rect);
 	}
 }
 
 typedef struct {
 	int frame;
-	float frame_timer;
 	Ingredient in_fire;
-	float cook_time;
 	bool cooking;
+	// Pending while cooking, -1 otherwise
+	int cook_timer;
 } Fire;
 
 typedef enum {
 	PLAYING_OK,
 	PLAYING_LOST,
+	// Asked for another go from the death screen
+	PLAYING_RETRY,
+	// Asked to go back in time, see Snapshots and rewind
+	PLAYING_REWIND,
 } Playing_Msg;
 
 typedef struct {
@@ -445,6 +1036,10 @@ typedef struct {
 	SDL_Texture * bg_texture;
 	SDL_Texture * death_texture;
 	SDL_Texture * ingredient_textures[INGRED_COUNT];
+	// The dragged ingredient is the mouse cursor, so it never lags the
+	// pointer. NULL where cursors aren't available; it's drawn instead,
+	// as it is while cursor_fits is false.
+	SDL_Cursor * ingredient_cursors[INGRED_COUNT];
 	SDL_Texture * logs_texture;
 	SDL_Texture * fire_textures[UI_FIRE_FRAMES];
 	SDL_Texture * god_textures[GOD_COUNT];
@@ -452,19 +1047,47 @@ typedef struct {
 	Fire fires[UI_FIRE_COUNT];
 	// Ingredients
 	Ingredient transient_ingredient;
-	Ingredient * transient_previous;
+	// Fire the dragged ingredient goes back to when dropped, or -1
+	int transient_fire;
 	// Gods
 	God tables[UI_TABLE_COUNT];
 	Ingredient * table_orders[UI_TABLE_COUNT];
+	// Gods not seated at a table, drawn from without replacement
+	God god_pool[GOD_COUNT];
+	int god_pool_count;
+	Spawn_Params spawn;
 	float god_spawn_reset;
 	float god_spawn_this_reset;
-	float god_spawn_timer;
+	int spawn_timer;
 	// Win?
 	bool lost;
-	float death_timer;
+	bool retry;
+	bool rewind_requested;
+	bool death_over;
 	float time_spent;
+	// Mouse buttons handled, see Input latency
+	uint32_t input_serial;
+	// Everything timed is scheduled here, see Playing timers
+	bool fixed_point;
+	uint64_t clock_us;
+	uint64_t spent_us;
+	uint32_t spawn_reset_ticks;
+	// spawn folded into integers by playing_set_spawn
+	int64_t spawn_mult_q16;
+	int64_t spawn_minimum_ticks;
+	Timer_Wheel timers;
+	// Randomness, one stream per consumer
+	Rng order_rng;
+	Rng god_rng;
+	Rng fire_rng;
 } State_Playing;
 
+typedef enum {
+	RNG_STREAM_ORDER,
+	RNG_STREAM_GOD,
+	RNG_STREAM_FIRE,
+} Rng_Stream;
+
 SDL_Rect ingredient_box(Ingredient ingredient)
 {
 	return make_SDL_Rect(UI_INGRED_X + (UI_INGRED_SIZE + UI_INGRED_SPACING) * ingredient,
@@ -510,64 +1133,198 @@ SDL_Rect fire_shelf_box(int fire)
 						 UI_FIRE_SHELF_Y, UI_INGRED_SIZE, UI_INGRED_SIZE);
 }
 
-void state_playing_init(State_Playing * state)
+// //
+// Playing timers
+// Cooking, the fire animation, god spawns and the death screen are all
+// timer wheel callbacks, so an update only does work for what is due.
+// Game time is kept in whole microseconds and timers count
+// PLAYING_TICKS_PER_SECOND ticks.
+//
+// With fixed_point set, nothing after a frame time is turned into
+// microseconds touches floating point: time survived is summed in
+// microseconds, spawn intervals are ticks scaled by a 16.16 multiplier
+// and fire frames are drawn as whole ticks. A session then plays out
+// bit for bit the same on any build and machine. Without it, the spawn
+// interval and time survived follow the original float math.
+#define PLAYING_TICKS_PER_SECOND 1000
+#define PLAYING_US_PER_TICK      (1000000 / PLAYING_TICKS_PER_SECOND)
+#define DEATH_SCREEN_TIME 5.0
+
+// What the callbacks get as their context
+typedef struct {
+	Engine * engine;
+	State_Playing * state;
+} Playing_Timer_Context;
+
+// Timer kinds, indexing playing_timer_callbacks
+typedef enum {
+	PLAYING_TIMER_COOK,
+	PLAYING_TIMER_FIRE_FRAME,
+	PLAYING_TIMER_SPAWN,
+	PLAYING_TIMER_DEATH,
+	PLAYING_TIMER_COUNT
+} Playing_Timer;
+
+// Rounded by llround, which no compiler can fuse with anything else
+uint64_t seconds_to_us(double seconds)
 {
-	// Play music
-	play_music(MUSIC_PLAYING);
+	return (uint64_t) llround(seconds * 1000000);
+}
+
+int playing_schedule(State_Playing * state, double seconds, Playing_Timer kind, int arg)
+{
+	uint64_t delay = (uint64_t) llround(seconds * PLAYING_TICKS_PER_SECOND);
+	return timer_wheel_schedule(&state->timers, delay, kind, arg);
+}
+
+// Sets the spawn parameters, and folds them into the 16.16 multiplier
+// and the minimum in ticks that spawn_reset_next_ticks takes
+void playing_set_spawn(State_Playing * state, Spawn_Params params)
+{
+	state->spawn = params;
+	state->spawn_mult_q16 = llround((params.sub_base_mult - params.difficulty / params.sub_mult_div) * 65536);
+	state->spawn_minimum_ticks = llround((params.minimum_spawn_time - params.difficulty / params.mst_div) *
+										 PLAYING_TICKS_PER_SECOND);
+}
+
+// spawn_reset_next in ticks, with only integer math
+uint32_t spawn_reset_next_ticks(State_Playing * state, uint32_t reset)
+{
+	int64_t next = ((int64_t) reset * state->spawn_mult_q16) >> 16;
+	return (uint32_t) SDL_max(next, state->spawn_minimum_ticks);
+}
+
+// Seconds until the timer fires
+float playing_timer_left(State_Playing * state, int timer)
+{
+	return (float) timer_wheel_remaining(&state->timers, timer) / PLAYING_TICKS_PER_SECOND;
+}
+
+// Stops everything but the death screen countdown
+void playing_lose(State_Playing * state)
+{
+	state->lost = true;
+	timer_wheel_clear(&state->timers);
+	state->spawn_timer = -1;
+	for (int i = 0; i < UI_FIRE_COUNT; i++) {
+		state->fires[i].cook_timer = -1;
+	}
+	playing_schedule(state, DEATH_SCREEN_TIME, PLAYING_TIMER_DEATH, 0);
+}
+// //
+
+// Resets the simulation data, leaving the textures alone
+void state_playing_reset(Engine * engine, State_Playing * state, uint32_t seed)
+{
+	// Everything random in a session follows from the seed
+	rng_seed(&state->order_rng, seed, RNG_STREAM_ORDER);
+	rng_seed(&state->god_rng, seed, RNG_STREAM_GOD);
+	rng_seed(&state->fire_rng, seed, RNG_STREAM_FIRE);
 
 	// Transient init
 	state->transient_ingredient = INGRED_NONE;
-	state->transient_previous = NULL;
+	state->transient_fire = -1;
+
+	// Timers
+	state->fixed_point = engine->fixed_point;
+	state->clock_us = 0;
+	timer_wheel_init(&state->timers, 0);
 
 	// Fire init
 	for (int i = 0; i < UI_FIRE_COUNT; i++) {
 		state->fires[i].frame = 0;
-		state->fires[i].frame_timer = UI_FIRE_FPS;
 		state->fires[i].in_fire = INGRED_NONE;
-		state->fires[i].cook_time = COOK_TIME;
 		state->fires[i].cooking = false;
+		state->fires[i].cook_timer = -1;
+		playing_schedule(state, UI_FIRE_FPS, PLAYING_TIMER_FIRE_FRAME, i);
 	}
 	
-	// Gods
+	// Gods. Order buffers are kept across resets, so a state has to
+	// start out zeroed.
 	for (int i = 0; i < UI_TABLE_COUNT; i++) {
 		state->tables[i] = GOD_NONE;
-		state->table_orders[i] = NULL;
+		if (state->table_orders[i]) {
+			stb__sbn(state->table_orders[i]) = 0;
+		}
 	}
-	state->god_spawn_reset = 10.0;
+	for (int i = 0; i < GOD_COUNT; i++) {
+		state->god_pool[i] = (God) i;
+	}
+	state->god_pool_count = GOD_COUNT;
+	playing_set_spawn(state, default_spawn_params(engine->difficulty));
+	state->god_spawn_reset = SPAWN_FIRST_RESET;
 	state->god_spawn_this_reset = state->god_spawn_reset;
-	state->god_spawn_timer = 0.0;
-	
-	// Death timer
-	state->death_timer = 5.0;
+	state->spawn_reset_ticks = SPAWN_FIRST_RESET * PLAYING_TICKS_PER_SECOND;
+	// The first god arrives on the first update
+	state->spawn_timer = playing_schedule(state, 0.0, PLAYING_TIMER_SPAWN, 0);
+
+	// Win?
+	state->lost = false;
+	state->retry = false;
+	state->rewind_requested = false;
+	state->death_over = false;
+	state->time_spent = 0.0;
+	state->spent_us = 0;
+	state->input_serial = 0;
+}
+
+Texture_Load * state_playing_texture_loads(State_Playing * state)
+{
+	Texture_Load * loads = NULL;
 
 	// Background texture
-	state->bg_texture = load_texture_from_path("resources/bg.png");
+	texture_load_add(&loads, &state->bg_texture, "resources/bg.png");
 
 	// Death screen texture
-	state->death_texture = load_texture_from_path("resources/death.png");
+	texture_load_add(&loads, &state->death_texture, "resources/death.png");
 	
 	// Ingredient textures
 	for (int i = 0; i < INGRED_COUNT; i++) {
-		state->ingredient_textures[i] =
-			load_texture_from_path(ingredient_texture_paths[i]);
+		texture_load_add(&loads, &state->ingredient_textures[i], ingredient_texture_paths[i]);
+		sb_last(loads).cursor = &state->ingredient_cursors[i];
+		sb_last(loads).cursor_size = UI_INGRED_SIZE;
 	}
 
 	// Bonfire textures
-	state->logs_texture = load_texture_from_path("resources/logs.png");
+	texture_load_add(&loads, &state->logs_texture, "resources/logs.png");
 	for (int i = 0; i < UI_FIRE_FRAMES; i++) {
 		char buffer[512];
 		sprintf(buffer, "resources/fire%d.png", i);
-		state->fire_textures[i] = load_texture_from_path(buffer);
+		texture_load_add(&loads, &state->fire_textures[i], buffer);
 	}
 
 	// God textures
 	for (int i = 0; i < GOD_COUNT; i++) {
-		state->god_textures[i] = load_texture_from_path(god_texture_paths[i]);
+		texture_load_add(&loads, &state->god_textures[i], god_texture_paths[i]);
 	}
 
-	// Win?
-	state->lost = false;
-	state->time_spent = 0.0;
+	return loads;
+}
+
+void state_playing_load_textures(Engine * engine, State_Playing * state)
+{
+	load_textures(engine, state_playing_texture_loads(state));
+}
+
+// Call once the textures are loaded and the state is done with
+void state_playing_free_cursors(Engine * engine, State_Playing * state)
+{
+	cursor_show(engine, NULL);
+	for (int i = 0; i < INGRED_COUNT; i++) {
+		if (state->ingredient_cursors[i]) {
+			SDL_FreeCursor(state->ingredient_cursors[i]);
+			state->ingredient_cursors[i] = NULL;
+		}
+	}
+}
+
+// Textures are loaded separately, see Asset streaming
+void state_playing_init(Engine * engine, State_Playing * state, uint32_t seed)
+{
+	// Play music
+	play_music(engine, MUSIC_PLAYING);
+
+	state_playing_reset(engine, state, seed);
 }
 
 Ingredient generator_click(Vector2 pos)
@@ -606,32 +1363,39 @@ int over_table(Vector2 pos)
 	return -1;
 }
 
+SDL_Rect trash_box()
+{
+	return make_SDL_Rect(UI_TRASH_X, UI_TRASH_Y, UI_TRASH_SIZE, UI_TRASH_SIZE);
+}
+
 bool over_trashcan(Vector2 pos)
 {
 	SDL_Point point = (SDL_Point) { pos.x, pos.y };
-	SDL_Rect rect = (SDL_Rect) { UI_TRASH_X, UI_TRASH_Y, UI_TRASH_SIZE, UI_TRASH_SIZE };
+	SDL_Rect rect = trash_box();
 	return SDL_PointInRect(&point, &rect);
 }
 
-void state_playing_mbdown(State_Playing * state, Vector2 mpos)
+void state_playing_mbdown(Engine * engine, State_Playing * state, Vector2 mpos)
 {
 	// Check ingredient generators
 	if (generator_click(mpos) != INGRED_NONE) {
 		Ingredient new_ingredient = generator_click(mpos);
 		state->transient_ingredient = new_ingredient;
+		// Fresh from a generator, so there is no fire to go back to
+		state->transient_fire = -1;
 	}
 	// Check fire
 	if (over_fire(mpos) != -1) {
 		Fire * fire = &state->fires[over_fire(mpos)];
 		if (fire->in_fire != INGRED_NONE && !fire->cooking) {
 			state->transient_ingredient = fire->in_fire;
-			state->transient_previous = &fire->in_fire;
+			state->transient_fire = over_fire(mpos);
 			fire->in_fire = INGRED_NONE;
 		}
 	}
 }
 
-void state_playing_mbup(State_Playing * state, Vector2 mpos)
+void state_playing_mbup(Engine * engine, State_Playing * state, Vector2 mpos)
 {
 	if (state->transient_ingredient == INGRED_NONE) {
 		return;
@@ -641,11 +1405,11 @@ void state_playing_mbup(State_Playing * state, Vector2 mpos)
 	if (over_fire(mpos) != -1) {
 		Fire * fire = &state->fires[over_fire(mpos)];
 		if (fire->in_fire == INGRED_NONE && state->transient_ingredient < INGRED_UNCOOKED_COUNT) {
-			play_sound(SOUND_TSCH);
+			play_sound(engine, SOUND_TSCH);
 			fire->in_fire = state->transient_ingredient;
-			state->transient_previous = NULL;
-			fire->cook_time = COOK_TIME;
+			state->transient_fire = -1;
 			fire->cooking = true;
+			fire->cook_timer = playing_schedule(state, COOK_TIME, PLAYING_TIMER_COOK, over_fire(mpos));
 		}
 	}
 	
@@ -654,10 +1418,11 @@ void state_playing_mbup(State_Playing * state, Vector2 mpos)
 		int table = over_table(mpos);
 		if (state->tables[table] != GOD_NONE &&
 			sb_last(state->table_orders[table]) == state->transient_ingredient) {
-			god_eating_sound(state->tables[table]);
+			god_eating_sound(engine, state->tables[table]);
 			sb_pop(state->table_orders[table]);
-			state->transient_previous = NULL;
+			state->transient_fire = -1;
 			if (sb_count(state->table_orders[table]) == 0) {
+				state->god_pool[state->god_pool_count++] = state->tables[table];
 				state->tables[table] = GOD_NONE;
 			}
 		}
@@ -666,238 +1431,3836 @@ void state_playing_mbup(State_Playing * state, Vector2 mpos)
 	// Check trashcan
 	if (over_trashcan(mpos)) {
 		state->transient_ingredient = INGRED_NONE;
-		state->transient_previous = NULL;
+		state->transient_fire = -1;
 	}
 	
-	if (state->transient_previous) {
-		*state->transient_previous = state->transient_ingredient;
+	if (state->transient_fire != -1) {
+		state->fires[state->transient_fire].in_fire = state->transient_ingredient;
+		state->transient_fire = -1;
 	}
 	state->transient_ingredient = INGRED_NONE;
 }
 
-void state_playing_event(State_Playing * state, SDL_Event event)
+// Goes back in time, see Snapshots and rewind
+#define REWIND_KEY SDL_SCANCODE_BACKSPACE
+// See Input filter
+#define PLAYING_INPUT (INPUT_MOUSE_BUTTONS | INPUT_KEY_DOWN)
+
+void state_playing_event(Engine * engine, State_Playing * state, SDL_Event event)
 {
-	switch (event.type) {
+	if (event.type == SDL_MOUSEBUTTONDOWN || event.type == SDL_MOUSEBUTTONUP) {
+		state->input_serial++;
+	}
+	// Clicking or pressing R on the death screen starts over right away
+	if (state->lost) {
+		if (event.type == SDL_MOUSEBUTTONDOWN ||
+			(event.type == SDL_KEYDOWN && event.key.keysym.scancode == SDL_SCANCODE_R)) {
+			state->retry = true;
+		}
+		return;
+	}
+	switch (event.type) {
 	case SDL_MOUSEBUTTONDOWN:
-		state_playing_mbdown(state, make_Vector2(event.button.x, event.button.y));
+		state_playing_mbdown(engine, state, make_Vector2(event.button.x, event.button.y));
 		break;
 	case SDL_MOUSEBUTTONUP:
-		state_playing_mbup(state, make_Vector2(event.button.x, event.button.y));
+		state_playing_mbup(engine, state, make_Vector2(event.button.x, event.button.y));
 		break;
 	case SDL_KEYDOWN:
 		if (event.key.keysym.scancode == SDL_SCANCODE_ESCAPE) {
-			state->lost = true;
+			playing_lose(state);
+		} else if (event.key.keysym.scancode == REWIND_KEY) {
+			state->rewind_requested = true;
 		}
 		break;
 	}
 }
 
-Ingredient * generate_order()
+// Fills items with a new order, bottom of the stack first
+int generate_order_items(Rng * rng, Ingredient * items)
+{
+	int amt = rng_range(rng, ORDER_MAX) + 1;
+	for (int i = 0; i < amt; i++) {
+		items[i] = rng_range(rng, INGRED_UNCOOKED_COUNT) + INGRED_UNCOOKED_COUNT;
+	}
+	return amt;
+}
+
+// Refills list, reusing its buffer
+Ingredient * generate_order(Rng * rng, Ingredient * list)
+{
+	if (list) {
+		stb__sbn(list) = 0;
+	}
+	Ingredient items[ORDER_MAX];
+	int amt = generate_order_items(rng, items);
+	for (int i = 0; i < amt; i++) {
+		sb_push(list, items[i]);
+	}
+	return list;
+}
+
+// Takes a random god out of the pool of unseated ones
+God draw_god(State_Playing * state)
+{
+	assert(state->god_pool_count > 0);
+	int i = rng_range(&state->god_rng, state->god_pool_count);
+	God g = state->god_pool[i];
+	state->god_pool[i] = state->god_pool[--state->god_pool_count];
+	return g;
+}
+
+void playing_cook_due(void * context, int fire)
+{
+	Playing_Timer_Context * timers = (Playing_Timer_Context*) context;
+	Fire * f = &timers->state->fires[fire];
+	play_sound(timers->engine, SOUND_TSS);
+	f->cooking = false;
+	f->cook_timer = -1;
+	f->in_fire += INGRED_UNCOOKED_COUNT;
+}
+
+// Fire animation lives in the simulation rather than the render, so the
+// simulation is the same whether or not frames get drawn. Frames last a
+// random 1x to 3x UI_FIRE_FPS, 2x on average.
+void playing_fire_frame_due(void * context, int fire)
+{
+	State_Playing * state = ((Playing_Timer_Context*) context)->state;
+	Fire * f = &state->fires[fire];
+	f->frame = (f->frame + 1) % UI_FIRE_FRAMES;
+	if (state->fixed_point) {
+		uint32_t ticks = UI_FIRE_FPS * PLAYING_TICKS_PER_SECOND;
+		timer_wheel_schedule(&state->timers, ticks + rng_range(&state->fire_rng, 2 * ticks + 1),
+							 PLAYING_TIMER_FIRE_FRAME, fire);
+	} else {
+		playing_schedule(state, UI_FIRE_FPS * (1.0 + 2.0 * rng_float(&state->fire_rng)),
+						 PLAYING_TIMER_FIRE_FRAME, fire);
+	}
+}
+
+void playing_spawn_due(void * context, int arg)
+{
+	Playing_Timer_Context * timers = (Playing_Timer_Context*) context;
+	State_Playing * state = timers->state;
+	if (state->fixed_point) {
+		uint32_t reset = state->spawn_reset_ticks;
+		state->spawn_timer = timer_wheel_schedule(&state->timers, reset, PLAYING_TIMER_SPAWN, 0);
+		state->spawn_reset_ticks = spawn_reset_next_ticks(state, reset);
+		// Only shown and observed
+		state->god_spawn_this_reset = (float) reset / PLAYING_TICKS_PER_SECOND;
+		state->god_spawn_reset = (float) state->spawn_reset_ticks / PLAYING_TICKS_PER_SECOND;
+	} else {
+		state->spawn_timer = playing_schedule(state, state->god_spawn_reset, PLAYING_TIMER_SPAWN, 0);
+		state->god_spawn_this_reset = state->god_spawn_reset;
+		state->god_spawn_reset = spawn_reset_next(&state->spawn, state->god_spawn_reset);
+	}
+	for (int i = 0; i < UI_TABLE_COUNT; i++) {
+		if (state->tables[i] == GOD_NONE) {
+			play_sound(timers->engine, SOUND_TABLED);
+			state->tables[i] = draw_god(state);
+			state->table_orders[i] = generate_order(&state->order_rng, state->table_orders[i]);
+			return;
+		}
+	}
+	// Full
+	play_sound(timers->engine, SOUND_THUNDER);
+	stop_music(timers->engine);
+	playing_lose(state);
+}
+
+void playing_death_due(void * context, int arg)
+{
+	((Playing_Timer_Context*) context)->state->death_over = true;
+}
+
+const Timer_Callback playing_timer_callbacks[PLAYING_TIMER_COUNT] = {
+	[PLAYING_TIMER_COOK]       = playing_cook_due,
+	[PLAYING_TIMER_FIRE_FRAME] = playing_fire_frame_due,
+	[PLAYING_TIMER_SPAWN]      = playing_spawn_due,
+	[PLAYING_TIMER_DEATH]      = playing_death_due,
+};
+
+Playing_Msg state_playing_update(Engine * engine, State_Playing * state, float delta_time)
+{
+	if (state->rewind_requested) {
+		state->rewind_requested = false;
+		return PLAYING_REWIND;
+	}
+
+	Playing_Timer_Context context = { engine, state };
+	uint64_t delta_us = seconds_to_us(delta_time);
+	state->clock_us += delta_us;
+	uint64_t now = state->clock_us / PLAYING_US_PER_TICK;
+
+	// Death screen
+	if (state->lost) {
+		if (state->retry) {
+			return PLAYING_RETRY;
+		}
+		timer_wheel_advance(&state->timers, now, playing_timer_callbacks, &context);
+		return state->death_over ? PLAYING_LOST : PLAYING_OK;
+	}
+
+	timer_wheel_advance(&state->timers, now, playing_timer_callbacks, &context);
+
+	if (state->fixed_point) {
+		state->spent_us += delta_us;
+		state->time_spent = (float) state->spent_us / 1000000;
+	} else {
+		state->time_spent += delta_time;
+	}
+
+	return PLAYING_OK;
+}
+
+// What state_playing_render draws, copied out of a State_Playing so it
+// can be drawn while the simulation carries on
+typedef struct {
+	Fire fires[UI_FIRE_COUNT];
+	Ingredient transient_ingredient;
+	God tables[UI_TABLE_COUNT];
+	Ingredient orders[UI_TABLE_COUNT][ORDER_MAX];
+	int order_counts[UI_TABLE_COUNT];
+	float god_spawn_timer;
+	float god_spawn_this_reset;
+	bool lost;
+	float time_spent;
+	uint32_t input_serial;
+} Playing_Snapshot;
+
+void playing_snapshot_take(State_Playing * state, Playing_Snapshot * snapshot)
+{
+	memcpy(snapshot->fires, state->fires, sizeof(snapshot->fires));
+	snapshot->transient_ingredient = state->transient_ingredient;
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		int count = sb_count(state->table_orders[t]);
+		assert(count <= ORDER_MAX);
+		snapshot->tables[t] = state->tables[t];
+		snapshot->order_counts[t] = count;
+		for (int i = 0; i < count; i++) {
+			snapshot->orders[t][i] = state->table_orders[t][i];
+		}
+	}
+	snapshot->god_spawn_timer = playing_timer_left(state, state->spawn_timer);
+	snapshot->god_spawn_this_reset = state->god_spawn_this_reset;
+	snapshot->lost = state->lost;
+	snapshot->time_spent = state->time_spent;
+	snapshot->input_serial = state->input_serial;
+}
+
+// Only the textures and cursors are read from state, and those never
+// change after loading
+void playing_snapshot_render(Engine * engine, State_Playing * state, Playing_Snapshot * snapshot)
+{
+	latency_shown(snapshot->input_serial);
+	// Death screen
+	if (snapshot->lost) {
+		cursor_show(engine, NULL);
+		render_copy(engine, state->death_texture, NULL, NULL);
+		char buffer[512];
+		sprintf(buffer, "You lasted %.0f seconds", snapshot->time_spent);
+		int w, h;
+		SDL_Texture * texture = render_text(engine, buffer, (SDL_Color) { 0xff, 0xff, 0xff, 0xff }, &w, &h);
+		SDL_Rect rect = (SDL_Rect) { DEATH_TEXT_X, DEATH_TEXT_Y, w, h };
+		render_copy(engine, texture, NULL, &rect);
+		SDL_DestroyTexture(texture);
+		return;
+	}
+
+	// Background
+	render_copy(engine, state->bg_texture, NULL, NULL);
+	
+	// Generators
+	for (int i = 0; i < INGRED_UNCOOKED_COUNT; i++) {
+		SDL_Rect rect = ingredient_box(i);
+		render_copy(engine, state->ingredient_textures[i], NULL, &rect);
+	}
+	
+	// Fire
+	for (int i = 0; i < UI_FIRE_COUNT; i++) {
+		Fire * fire = &snapshot->fires[i];
+		SDL_Rect rect = fire_box(i);
+		render_copy(engine, state->logs_texture, NULL, &rect);
+		render_copy(engine, state->fire_textures[fire->frame], NULL, &rect);
+		if (fire->in_fire != INGRED_NONE) {
+			SDL_Rect ingred_rect = fire_shelf_box(i);
+			render_copy(engine, state->ingredient_textures[fire->in_fire], NULL, &ingred_rect);
+		}
+	}
+
+	// Gods
+	for (int i = 0; i < UI_TABLE_COUNT; i++) {
+		God seated = snapshot->tables[i];
+		SDL_Rect rect = table_box(i);
+		if (seated != GOD_NONE) {
+			render_copy(engine, state->god_textures[seated], NULL, &rect);
+		}
+	}
+
+	// Orders
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		if (snapshot->tables[t] == GOD_NONE) continue;
+		for (int i = 0; i < snapshot->order_counts[t]; i++) {
+			SDL_Rect rect = order_box(t, i);
+			render_copy(engine, state->ingredient_textures[snapshot->orders[t][i]], NULL, &rect);
+		}
+	}
+
+	// Clock
+	{
+		SDL_SetRenderDrawColor(engine->sdl.renderer, 0xff, 0xff, 0xff, 0xff);
+		int ox = UI_CLOCK_X, oy = UI_CLOCK_Y;
+		float theta = (2.0 * PI) - (snapshot->god_spawn_timer / snapshot->god_spawn_this_reset) * 2.0 * PI;
+		theta -= (PI / 2.0);
+		int rx = ox + (UI_CLOCK_RADIUS * cos(theta));
+		int ry = oy + (UI_CLOCK_RADIUS * sin(theta));
+		render_draw_line(engine, ox, oy, rx, ry);
+	}
+
+	// Time scale, see Time scale
+	if (engine->time_scale != 1.0) {
+		char buffer[64];
+		sprintf(buffer, "%gx", engine->time_scale);
+		int w, h;
+		SDL_Texture * texture = render_text(engine, buffer, (SDL_Color) { 0xff, 0xff, 0xff, 0xff }, &w, &h);
+		SDL_Rect rect = (SDL_Rect) { TIME_SCALE_TEXT_X, TIME_SCALE_TEXT_Y, w, h };
+		render_copy(engine, texture, NULL, &rect);
+		SDL_DestroyTexture(texture);
+	}
+	
+	// Transient ingredient
+	SDL_Cursor * cursor = NULL;
+	if (snapshot->transient_ingredient != INGRED_NONE && cursor_fits(engine)) {
+		cursor = state->ingredient_cursors[snapshot->transient_ingredient];
+	}
+	cursor_show(engine, cursor);
+	if (snapshot->transient_ingredient != INGRED_NONE && !cursor) {
+		int mx = engine->sdl.mouse_x, my = engine->sdl.mouse_y;
+		SDL_Rect rect = make_SDL_Rect(mx - UI_INGRED_SIZE / 2, my - UI_INGRED_SIZE / 2,
+									  UI_INGRED_SIZE, UI_INGRED_SIZE);
+		render_copy(engine, state->ingredient_textures[snapshot->transient_ingredient], NULL, &rect);
+	}
+}
+
+void state_playing_render(Engine * engine, State_Playing * state)
+{
+	Playing_Snapshot snapshot;
+	playing_snapshot_take(state, &snapshot);
+	playing_snapshot_render(engine, state, &snapshot);
+}
+
+// //
+// Asset streaming
+// The window is shown before anything is loaded. Assets then stream in
+// on the job system one group at a time: the menu, then the playing
+// screen, then audio. Textures are uploaded and warmed on the main
+// thread between frames, so the whole playing screen is resident while
+// the menu is still up and starting a game doesn't stall.
+typedef enum {
+	ASSETS_MENU,
+	ASSETS_PLAYING,
+	ASSETS_AUDIO,
+	ASSETS_GROUP_COUNT
+} Asset_Group;
+
+typedef struct {
+	Engine * engine;
+	// Counts down to zero once the group is loaded
+	Job_Counter loaded[ASSETS_GROUP_COUNT];
+	Texture_Load * menu_loads;
+	Texture_Load * playing_loads;
+	Sound_Load sound_loads[SOUND_COUNT];
+	Job_Counter audio_open;
+	Job_Counter sounds_decoded;
+} Asset_Stream;
+
+void assets_load_font(void * data)
+{
+	Engine * engine = (Engine*) data;
+	if (!engine->default_font) {
+		engine->default_font = TTF_OpenFont("resources/EBGaramond12-AllSC.ttf", UI_FONT_SIZE);
+	}
+}
+
+// Music is only opened here and streamed while it plays
+void assets_open_audio(void * data)
+{
+	Engine * engine = (Engine*) data;
+	Mix_Init(MIX_INIT_OGG);
+	Mix_OpenAudio(MIX_DEFAULT_FREQUENCY, MIX_DEFAULT_FORMAT, 2, 1024);
+	for (int i = 0; i < MUSIC_COUNT; i++) {
+		engine->sound.music[i] = Mix_LoadMUS(music_paths[i]);
+	}
+}
+
+void assets_enable_audio(void * data)
+{
+	sound_enable((Engine*) data);
+}
+
+// Without audio, sound stays disabled like when headless. menu and
+// playing get their textures filled in as they arrive.
+void assets_start(Asset_Stream * assets, Engine * engine,
+				  State_Main_Menu * menu, State_Playing * playing, bool audio)
+{
+	Job_System * jobs = engine->jobs;
+	assets->engine = engine;
+	for (int i = 0; i < ASSETS_GROUP_COUNT; i++) {
+		jobs_counter_init(&assets->loaded[i]);
+	}
+	jobs_counter_init(&assets->audio_open);
+	jobs_counter_init(&assets->sounds_decoded);
+
+	// The font has to be opened on the thread that renders with it
+	jobs_run(jobs, assets_load_font, engine, JOB_MAIN_THREAD, NULL, &assets->loaded[ASSETS_MENU]);
+	assets->menu_loads = state_main_menu_texture_loads(menu);
+	load_textures_start(engine, assets->menu_loads, NULL, &assets->loaded[ASSETS_MENU]);
+
+	assets->playing_loads = state_playing_texture_loads(playing);
+	load_textures_start(engine, assets->playing_loads,
+						&assets->loaded[ASSETS_MENU], &assets->loaded[ASSETS_PLAYING]);
+
+	if (!audio) return;
+	// Opening the device initializes SDL's audio subsystem, so it stays
+	// on the main thread
+	jobs_run(jobs, assets_open_audio, engine, JOB_MAIN_THREAD,
+			 &assets->loaded[ASSETS_PLAYING], &assets->audio_open);
+	for (int i = 0; i < SOUND_COUNT; i++) {
+		assets->sound_loads[i] = (Sound_Load) { sound_paths[i], &engine->sound.sounds[i] };
+		jobs_run(jobs, sound_load_decode, &assets->sound_loads[i], JOB_ANY_THREAD,
+				 &assets->audio_open, &assets->sounds_decoded);
+	}
+	jobs_run(jobs, assets_enable_audio, engine, JOB_MAIN_THREAD,
+			 &assets->sounds_decoded, &assets->loaded[ASSETS_AUDIO]);
+}
+
+bool assets_ready(Asset_Stream * assets, Asset_Group group)
+{
+	return SDL_AtomicGet(&assets->loaded[group].pending) == 0;
+}
+
+// Loads the rest of the group right now, for when it is needed early
+void assets_wait(Asset_Stream * assets, Asset_Group group)
+{
+	jobs_wait(assets->engine->jobs, &assets->loaded[group]);
+}
+
+void assets_finish(Asset_Stream * assets)
+{
+	for (int i = 0; i < ASSETS_GROUP_COUNT; i++) {
+		assets_wait(assets, (Asset_Group) i);
+	}
+	sb_free(assets->menu_loads);
+	sb_free(assets->playing_loads);
+	assets->menu_loads = NULL;
+	assets->playing_loads = NULL;
+}
+// //
+
+// //
+// Session recording
+// A State_Playing session is stored as its seed and difficulty, then for
+// every frame the frame time, the mouse position and the events that were
+// dispatched to the state. Feeding these back through state_playing_event
+// and state_playing_update reproduces the session exactly. The magic says
+// which time mode the session was played in.
+#define SESSION_MAGIC       0x3334444c // "LD43"
+#define SESSION_MAGIC_FIXED 0x4634444c // "LD4F"
+
+typedef struct {
+	uint32_t magic;
+	uint32_t seed;
+	float difficulty;
+} Session_Header;
+
+typedef struct {
+	float delta_time;
+	int32_t mouse_x;
+	int32_t mouse_y;
+	int32_t event_count;
+} Session_Frame;
+
+typedef struct {
+	uint32_t type;
+	int32_t x;
+	int32_t y;
+	int32_t scancode;
+} Session_Event;
+
+typedef struct {
+	// printf-style pattern, %d is replaced by the session number
+	char * path;
+	int sessions;
+	FILE * file;
+	Session_Event * events;
+} Session_Recorder;
+
+static Session_Recorder session_recorder;
+
+bool session_event_recorded(SDL_Event event)
+{
+	return event.type == SDL_MOUSEBUTTONDOWN ||
+		event.type == SDL_MOUSEBUTTONUP ||
+		event.type == SDL_KEYDOWN;
+}
+
+void session_record_begin(Engine * engine, uint32_t seed)
+{
+	if (!session_recorder.path) return;
+	char buffer[512];
+	snprintf(buffer, sizeof(buffer), session_recorder.path, session_recorder.sessions++);
+	session_recorder.file = fopen(buffer, "wb");
+	if (!session_recorder.file) {
+		fprintf(stderr, "Could not open %s for recording\n", buffer);
+		return;
+	}
+	uint32_t magic = engine->fixed_point ? SESSION_MAGIC_FIXED : SESSION_MAGIC;
+	Session_Header header = { magic, seed, engine->difficulty };
+	fwrite(&header, sizeof(header), 1, session_recorder.file);
+}
+
+void session_record_event(SDL_Event event)
+{
+	if (!session_recorder.file || !session_event_recorded(event)) return;
+	Session_Event recorded = { event.type, 0, 0, 0 };
+	if (event.type == SDL_KEYDOWN) {
+		recorded.scancode = event.key.keysym.scancode;
+	} else {
+		recorded.x = event.button.x;
+		recorded.y = event.button.y;
+	}
+	sb_push(session_recorder.events, recorded);
+}
+
+// Call after each update, with the delta time it was given
+void session_record_frame(Engine * engine, float delta_time)
+{
+	if (!session_recorder.file) return;
+	Session_Frame frame = {
+		delta_time,
+		engine->sdl.mouse_x, engine->sdl.mouse_y,
+		sb_count(session_recorder.events),
+	};
+	fwrite(&frame, sizeof(frame), 1, session_recorder.file);
+	fwrite(session_recorder.events, sizeof(Session_Event), frame.event_count, session_recorder.file);
+	stb__sbn(session_recorder.events) = 0;
+}
+
+void session_record_end()
+{
+	if (!session_recorder.file) return;
+	fclose(session_recorder.file);
+	session_recorder.file = NULL;
+	if (session_recorder.events) {
+		stb__sbn(session_recorder.events) = 0;
+	}
+}
+
+typedef struct {
+	Session_Header header;
+	Session_Frame * frames;
+	// Events of all frames, back to back
+	Session_Event * events;
+	double duration;
+} Session;
+
+bool session_load(Session * session, char * path)
+{
+	memset(session, 0, sizeof(Session));
+	FILE * file = fopen(path, "rb");
+	if (!file) return false;
+	if (fread(&session->header, sizeof(Session_Header), 1, file) != 1 ||
+		(session->header.magic != SESSION_MAGIC && session->header.magic != SESSION_MAGIC_FIXED)) {
+		fclose(file);
+		return false;
+	}
+	Session_Frame frame;
+	while (fread(&frame, sizeof(frame), 1, file) == 1) {
+		Session_Event * events = sb_add(session->events, frame.event_count);
+		if (fread(events, sizeof(Session_Event), frame.event_count, file) != (size_t) frame.event_count) {
+			break;
+		}
+		sb_push(session->frames, frame);
+		session->duration += frame.delta_time;
+	}
+	fclose(file);
+	return true;
+}
+
+SDL_Event session_event_to_sdl(Session_Event recorded)
+{
+	SDL_Event event;
+	memset(&event, 0, sizeof(event));
+	event.type = recorded.type;
+	if (recorded.type == SDL_KEYDOWN) {
+		event.key.keysym.scancode = recorded.scancode;
+	} else {
+		event.button.x = recorded.x;
+		event.button.y = recorded.y;
+	}
+	return event;
+}
+// //
+
+// //
+// Snapshots and rewind
+// A Sim_Snapshot is everything State_Playing simulates, with no
+// pointers in it: orders are copied out of their buffers and timers are
+// kept by index. Restoring one into any State_Playing forks the
+// session from that point, which is how bots and search can try many
+// branches from the same position.
+//
+// Playing keeps the last REWIND_SECONDS of snapshots in a Rewind_Ring.
+// Each is stored as the bytes that changed since the one before, with
+// a keyframe every REWIND_KEYFRAME, and pressing REWIND_KEY goes back
+// REWIND_STEP seconds.
+#define REWIND_SECONDS    10
+#define REWIND_PER_SECOND 10
+#define REWIND_KEYFRAME   20
+// Enough that the oldest REWIND_SECONDS always has a keyframe under it
+#define REWIND_ENTRIES    (REWIND_SECONDS * REWIND_PER_SECOND + REWIND_KEYFRAME)
+#define REWIND_STEP       3.0
+// Unchanged bytes that end a run of changed ones in a delta
+#define DELTA_MIN_GAP     4
+
+typedef struct {
+	Fire fires[UI_FIRE_COUNT];
+	Ingredient transient_ingredient;
+	int transient_fire;
+	God tables[UI_TABLE_COUNT];
+	Ingredient orders[UI_TABLE_COUNT][ORDER_MAX];
+	int order_counts[UI_TABLE_COUNT];
+	God god_pool[GOD_COUNT];
+	int god_pool_count;
+	Spawn_Params spawn;
+	float god_spawn_reset;
+	float god_spawn_this_reset;
+	int spawn_timer;
+	bool lost;
+	bool death_over;
+	float time_spent;
+	bool fixed_point;
+	uint64_t clock_us;
+	uint64_t spent_us;
+	uint32_t spawn_reset_ticks;
+	int64_t spawn_mult_q16;
+	int64_t spawn_minimum_ticks;
+	Rng order_rng;
+	Rng god_rng;
+	Rng fire_rng;
+	Timer_Wheel timers;
+} Sim_Snapshot;
+
+// Padding is zeroed, so equal simulations give equal bytes
+void sim_snapshot_take(State_Playing * state, Sim_Snapshot * snapshot)
+{
+	memset(snapshot, 0, sizeof(Sim_Snapshot));
+	memcpy(snapshot->fires, state->fires, sizeof(snapshot->fires));
+	snapshot->transient_ingredient = state->transient_ingredient;
+	snapshot->transient_fire = state->transient_fire;
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		int count = sb_count(state->table_orders[t]);
+		assert(count <= ORDER_MAX);
+		snapshot->tables[t] = state->tables[t];
+		snapshot->order_counts[t] = count;
+		for (int i = 0; i < count; i++) {
+			snapshot->orders[t][i] = state->table_orders[t][i];
+		}
+	}
+	memcpy(snapshot->god_pool, state->god_pool, sizeof(snapshot->god_pool));
+	snapshot->god_pool_count = state->god_pool_count;
+	snapshot->spawn = state->spawn;
+	snapshot->god_spawn_reset = state->god_spawn_reset;
+	snapshot->god_spawn_this_reset = state->god_spawn_this_reset;
+	snapshot->spawn_timer = state->spawn_timer;
+	snapshot->lost = state->lost;
+	snapshot->death_over = state->death_over;
+	snapshot->time_spent = state->time_spent;
+	snapshot->fixed_point = state->fixed_point;
+	snapshot->clock_us = state->clock_us;
+	snapshot->spent_us = state->spent_us;
+	snapshot->spawn_reset_ticks = state->spawn_reset_ticks;
+	snapshot->spawn_mult_q16 = state->spawn_mult_q16;
+	snapshot->spawn_minimum_ticks = state->spawn_minimum_ticks;
+	snapshot->order_rng = state->order_rng;
+	snapshot->god_rng = state->god_rng;
+	snapshot->fire_rng = state->fire_rng;
+	snapshot->timers = state->timers;
+}
+
+// Textures are left alone, and order buffers are reused
+void sim_snapshot_restore(State_Playing * state, Sim_Snapshot * snapshot)
+{
+	memcpy(state->fires, snapshot->fires, sizeof(state->fires));
+	state->transient_ingredient = snapshot->transient_ingredient;
+	state->transient_fire = snapshot->transient_fire;
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		state->tables[t] = snapshot->tables[t];
+		if (state->table_orders[t]) {
+			stb__sbn(state->table_orders[t]) = 0;
+		}
+		for (int i = 0; i < snapshot->order_counts[t]; i++) {
+			sb_push(state->table_orders[t], snapshot->orders[t][i]);
+		}
+	}
+	memcpy(state->god_pool, snapshot->god_pool, sizeof(state->god_pool));
+	state->god_pool_count = snapshot->god_pool_count;
+	state->spawn = snapshot->spawn;
+	state->god_spawn_reset = snapshot->god_spawn_reset;
+	state->god_spawn_this_reset = snapshot->god_spawn_this_reset;
+	state->spawn_timer = snapshot->spawn_timer;
+	state->lost = snapshot->lost;
+	state->retry = false;
+	state->rewind_requested = false;
+	state->death_over = snapshot->death_over;
+	state->time_spent = snapshot->time_spent;
+	state->fixed_point = snapshot->fixed_point;
+	state->clock_us = snapshot->clock_us;
+	state->spent_us = snapshot->spent_us;
+	state->spawn_reset_ticks = snapshot->spawn_reset_ticks;
+	state->spawn_mult_q16 = snapshot->spawn_mult_q16;
+	state->spawn_minimum_ticks = snapshot->spawn_minimum_ticks;
+	state->order_rng = snapshot->order_rng;
+	state->god_rng = snapshot->god_rng;
+	state->fire_rng = snapshot->fire_rng;
+	state->timers = snapshot->timers;
+}
+
+void delta_put_u16(uint8_t ** out, int value)
+{
+	sb_push(*out, value & 0xff);
+	sb_push(*out, value >> 8);
+}
+
+// Appends to out what turns base into next: pairs of an unchanged byte
+// count and a run of new bytes, each count a little-endian uint16
+_Static_assert(sizeof(Sim_Snapshot) <= 0xffff, "delta counts are uint16");
+void delta_encode(const uint8_t * base, const uint8_t * next, int size, uint8_t ** out)
+{
+	int i = 0;
+	while (i < size) {
+		int start = i;
+		while (i < size && base[i] == next[i]) i++;
+		if (i == size) break;
+		int skip = i - start;
+		int run = i;
+		int gap = 0;
+		while (i < size && gap < DELTA_MIN_GAP) {
+			gap = base[i] == next[i] ? gap + 1 : 0;
+			i++;
+		}
+		if (gap == DELTA_MIN_GAP || i == size) {
+			i -= gap;
+		}
+		delta_put_u16(out, skip);
+		delta_put_u16(out, i - run);
+		for (int j = run; j < i; j++) {
+			sb_push(*out, next[j]);
+		}
+	}
+}
+
+void delta_apply(uint8_t * data, const uint8_t * delta, int delta_size)
+{
+	int at = 0;
+	for (int i = 0; i < delta_size;) {
+		at += delta[i] | (delta[i + 1] << 8);
+		int run = delta[i + 2] | (delta[i + 3] << 8);
+		i += 4;
+		memcpy(data + at, delta + i, run);
+		at += run;
+		i += run;
+	}
+}
+
+typedef struct {
+	uint64_t clock_us;
+	// Stored against zero rather than the entry before
+	bool keyframe;
+	// Stretchy, kept between uses
+	uint8_t * delta;
+} Rewind_Entry;
+
+typedef struct {
+	Rewind_Entry entries[REWIND_ENTRIES];
+	int first;
+	int count;
+	int since_keyframe;
+	uint64_t next_us;
+	// What the newest entry decodes to
+	Sim_Snapshot last;
+	Sim_Snapshot scratch;
+} Rewind_Ring;
+
+static const Sim_Snapshot rewind_zero;
+
+Rewind_Ring * rewind_create()
+{
+	return (Rewind_Ring*) calloc(1, sizeof(Rewind_Ring));
+}
+
+void rewind_free(Rewind_Ring * ring)
+{
+	if (!ring) return;
+	for (int i = 0; i < REWIND_ENTRIES; i++) {
+		sb_free(ring->entries[i].delta);
+	}
+	free(ring);
+}
+
+// For a new session
+void rewind_clear(Rewind_Ring * ring)
+{
+	ring->count = 0;
+	ring->next_us = 0;
+}
+
+Rewind_Entry * rewind_entry(Rewind_Ring * ring, int i)
+{
+	return &ring->entries[(ring->first + i) % REWIND_ENTRIES];
+}
+
+// Call after every update; saves REWIND_PER_SECOND snapshots a second
+void rewind_record(Rewind_Ring * ring, State_Playing * state)
+{
+	if (!ring || state->clock_us < ring->next_us) return;
+	ring->next_us = state->clock_us + 1000000 / REWIND_PER_SECOND;
+	if (ring->count == REWIND_ENTRIES) {
+		ring->first = (ring->first + 1) % REWIND_ENTRIES;
+		ring->count--;
+	}
+	bool keyframe = ring->count == 0 || ring->since_keyframe + 1 >= REWIND_KEYFRAME;
+	Rewind_Entry * entry = rewind_entry(ring, ring->count++);
+	entry->clock_us = state->clock_us;
+	entry->keyframe = keyframe;
+	if (entry->delta) {
+		stb__sbn(entry->delta) = 0;
+	}
+	sim_snapshot_take(state, &ring->scratch);
+	const Sim_Snapshot * base = keyframe ? &rewind_zero : &ring->last;
+	delta_encode((const uint8_t*) base, (const uint8_t*) &ring->scratch, sizeof(Sim_Snapshot), &entry->delta);
+	ring->since_keyframe = keyframe ? 0 : ring->since_keyframe + 1;
+	ring->last = ring->scratch;
+}
+
+// Goes back to the newest snapshot at or before clock_us, or the oldest
+// one there is, and forgets everything after it
+bool rewind_restore(Rewind_Ring * ring, State_Playing * state, int64_t clock_us)
+{
+	if (!ring) return false;
+	int target = -1;
+	int keyframe = -1;
+	for (int i = 0; i < ring->count; i++) {
+		Rewind_Entry * entry = rewind_entry(ring, i);
+		bool before = (int64_t) entry->clock_us <= clock_us;
+		if (entry->keyframe && (before || keyframe == -1)) {
+			keyframe = i;
+		}
+		if (keyframe != -1 && (before || target == -1)) {
+			target = i;
+		}
+	}
+	if (target == -1) return false;
+
+	Sim_Snapshot * snapshot = &ring->scratch;
+	*snapshot = rewind_zero;
+	for (int i = keyframe; i <= target; i++) {
+		Rewind_Entry * entry = rewind_entry(ring, i);
+		delta_apply((uint8_t*) snapshot, entry->delta, sb_count(entry->delta));
+	}
+	sim_snapshot_restore(state, snapshot);
+	// The press that started a drag back then is over, so the drag ends
+	// like a release over nothing: food goes back on its fire and
+	// anything from a generator is dropped
+	if (state->transient_fire != -1) {
+		state->fires[state->transient_fire].in_fire = state->transient_ingredient;
+	}
+	state->transient_ingredient = INGRED_NONE;
+	state->transient_fire = -1;
+	ring->count = target + 1;
+	ring->since_keyframe = target - keyframe;
+	ring->next_us = rewind_entry(ring, target)->clock_us + 1000000 / REWIND_PER_SECOND;
+	ring->last = *snapshot;
+	return true;
+}
+
+// state_playing_update for sessions that can be rewound
+Playing_Msg state_playing_step(Engine * engine, State_Playing * state, Rewind_Ring * ring, float delta_time)
+{
+	Playing_Msg msg = state_playing_update(engine, state, delta_time);
+	if (msg == PLAYING_REWIND) {
+		rewind_restore(ring, state, (int64_t) state->clock_us - (int64_t) seconds_to_us(REWIND_STEP));
+		msg = PLAYING_OK;
+	}
+	rewind_record(ring, state);
+	return msg;
+}
+// //
+
+// //
+// Time scale
+// Play can run slower or faster than real time, so the late game can be
+// reached and profiled without sitting through the early one. A scaled
+// frame is fed to the simulation in steps of at most TIME_SCALE_STEP, so
+// turbo plays out like many ordinary frames rather than one huge one,
+// and each step is recorded as its own session frame. At TURBO_SCALE and
+// up only TURBO_RENDER_FPS frames a second are drawn, leaving the rest
+// of the time to the simulation.
+#define TIME_SCALE_MIN    0.125
+#define TIME_SCALE_MAX    256.0
+#define TIME_SCALE_STEP   (1.0 / 60.0)
+#define TURBO_SCALE       4.0
+#define TURBO_RENDER_FPS  10.0
+#define TIME_SLOWER_KEY   SDL_SCANCODE_F2
+#define TIME_FASTER_KEY   SDL_SCANCODE_F3
+#define TIME_RESET_KEY    SDL_SCANCODE_F4
+
+bool time_scale_event(Engine * engine, SDL_Event event)
+{
+	if (event.type != SDL_KEYDOWN) return false;
+	float scale = engine->time_scale;
+	switch (event.key.keysym.scancode) {
+	case TIME_SLOWER_KEY:
+		scale = SDL_max(scale / 2, TIME_SCALE_MIN);
+		break;
+	case TIME_FASTER_KEY:
+		scale = SDL_min(scale * 2, TIME_SCALE_MAX);
+		break;
+	case TIME_RESET_KEY:
+		scale = 1.0;
+		break;
+	default:
+		return false;
+	}
+	// Shown on the playing screen
+	engine->time_scale = scale;
+	return true;
+}
+
+bool time_scale_turbo(Engine * engine)
+{
+	return engine->time_scale >= TURBO_SCALE;
+}
+
+// state_playing_step over delta_time of real time
+Playing_Msg state_playing_advance(Engine * engine, State_Playing * state, Rewind_Ring * ring, float delta_time)
+{
+	if (engine->time_scale == 1.0) {
+		Playing_Msg msg = state_playing_step(engine, state, ring, delta_time);
+		session_record_frame(engine, delta_time);
+		return msg;
+	}
+	double scaled = (double) delta_time * engine->time_scale;
+	int steps = SDL_max((int) ceil(scaled / TIME_SCALE_STEP), 1);
+	float step = (float) (scaled / steps);
+	Playing_Msg msg = PLAYING_OK;
+	for (int i = 0; i < steps && msg == PLAYING_OK; i++) {
+		msg = state_playing_step(engine, state, ring, step);
+		session_record_frame(engine, step);
+	}
+	return msg;
+}
+// //
+
+// //
+// Frame pacing
+// With --jit, the renderer presents with vsync and frames start as late
+// as they can and still be presented by the next refresh. The main loop
+// sleeps until the next deadline, less what frames have cost lately,
+// then polls input, simulates, renders and presents, so the input and
+// mouse position on screen are as fresh as they can be. A frame's cost
+// stops short of the present, which would otherwise count the wait for
+// the refresh and make every later frame start earlier. Deadlines are a
+// refresh period apart. A present that ends past its deadline moves
+// them to where it ended, the refresh it waited for, which locks them
+// onto the display. A driver without vsync only gets its frame rate
+// capped at the refresh rate.
+#define PACING_HISTORY 32
+// Headroom over the slowest recent frame
+#define PACING_MARGIN  0.001
+// SDL_Delay can oversleep by about this much, so the end is spun
+#define PACING_SPIN    0.002
+#define PACING_DEFAULT_HZ 60
+
+typedef struct {
+	bool enabled;
+	double frequency;
+	uint64_t period;
+	// The refresh the frame being made is for
+	uint64_t deadline;
+	uint64_t started;
+	// Ring of seconds from waking up to the start of the present
+	double costs[PACING_HISTORY];
+	int cost_count;
+	int next_cost;
+} Frame_Pacer;
+
+void pacer_init(Frame_Pacer * pacer, bool enabled, SDL_Window * window)
+{
+	memset(pacer, 0, sizeof(Frame_Pacer));
+	pacer->enabled = enabled;
+	pacer->frequency = (double) SDL_GetPerformanceFrequency();
+	int hz = PACING_DEFAULT_HZ;
+	SDL_DisplayMode mode;
+	if (window && SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0) {
+		hz = mode.refresh_rate;
+	}
+	pacer->period = (uint64_t) (pacer->frequency / hz);
+	pacer->deadline = SDL_GetPerformanceCounter();
+}
+
+// What the next frame is expected to take: the slowest of the recent ones
+double pacer_estimate(Frame_Pacer * pacer)
+{
+	double cost = 0.0;
+	for (int i = 0; i < pacer->cost_count; i++) {
+		cost = SDL_max(cost, pacer->costs[i]);
+	}
+	return cost + PACING_MARGIN;
+}
+
+// Call before polling input
+void pacer_wait(Frame_Pacer * pacer)
+{
+	if (!pacer->enabled) return;
+	uint64_t cost = (uint64_t) (pacer_estimate(pacer) * pacer->frequency);
+	uint64_t now = SDL_GetPerformanceCounter();
+	// The next refresh there is still time to make
+	if (pacer->deadline < now + cost) {
+		pacer->deadline += ((now + cost - pacer->deadline) / pacer->period + 1) * pacer->period;
+	}
+	uint64_t wake = pacer->deadline - cost;
+	if (now < wake) {
+		double left = (wake - now) / pacer->frequency;
+		if (left > PACING_SPIN) {
+			SDL_Delay((uint32_t) ((left - PACING_SPIN) * 1000));
+		}
+		while (SDL_GetPerformanceCounter() < wake) {
+			// Spin out the rest
+		}
+	}
+	pacer->started = SDL_GetPerformanceCounter();
+}
+
+// Call right before SDL_RenderPresent
+void pacer_rendered(Frame_Pacer * pacer)
+{
+	if (!pacer->enabled) return;
+	uint64_t now = SDL_GetPerformanceCounter();
+	pacer->costs[pacer->next_cost] = (now - pacer->started) / pacer->frequency;
+	pacer->next_cost = (pacer->next_cost + 1) % PACING_HISTORY;
+	pacer->cost_count = SDL_min(pacer->cost_count + 1, PACING_HISTORY);
+}
+
+// Call right after SDL_RenderPresent
+void pacer_presented(Frame_Pacer * pacer)
+{
+	if (!pacer->enabled) return;
+	uint64_t now = SDL_GetPerformanceCounter();
+	if (now > pacer->deadline) {
+		pacer->deadline = now;
+	}
+}
+// //
+
+// //
+// Render scale
+// With --render-scale, the layout's SCREEN_WIDTH x SCREEN_HEIGHT is drawn
+// into a target texture of its own resolution, which is then stretched
+// to the window through SDL_RenderSetLogicalSize. The window becomes
+// resizable and letterboxed. The target can be smaller than the layout
+// for slow machines, or follow the window for large ones ("native").
+// SDL maps event coordinates into the layout; the polled mouse position
+// goes through render_scale_mouse.
+//
+// With --render-budget, the scale also moves in RENDER_SCALE_STEP steps
+// to keep drawing under the budget, never above the scale it was given.
+// Frames are timed up to the present, so with --jit the wait for the
+// refresh does not count against the budget.
+#define RENDER_SCALE_MIN      0.25
+#define RENDER_SCALE_MAX      4.0
+#define RENDER_SCALE_STEP     (1.0 / 16.0)
+// Frames between budget changes, so each has time to show in the cost
+#define RENDER_SCALE_SETTLE   30
+// Scaling back up only once frames are this far under budget
+#define RENDER_SCALE_HEADROOM 0.75
+
+typedef struct {
+	bool enabled;
+	// Target follows the window
+	bool native;
+	float scale;
+	// Most the budget may scale up to
+	float max_scale;
+	// SDL_HINT_RENDER_SCALE_QUALITY for the stretch
+	char * filter;
+	// Seconds per frame, 0 for a fixed scale
+	double budget;
+	double cost;
+	int settle;
+	uint64_t started;
+	SDL_Texture * target;
+	int target_w;
+	int target_h;
+} Render_Scale;
+
+void render_scale_init(Render_Scale * rs)
+{
+	memset(rs, 0, sizeof(Render_Scale));
+	rs->scale = 1.0;
+	rs->filter = "linear";
+}
+
+// Call once the renderer exists
+void render_scale_attach(Render_Scale * rs, SDL_Renderer * renderer)
+{
+	if (!rs->enabled) return;
+	SDL_RenderSetLogicalSize(renderer, SCREEN_WIDTH, SCREEN_HEIGHT);
+	rs->max_scale = rs->scale;
+}
+
+// Largest scale that fits the window
+float render_scale_native(SDL_Renderer * renderer)
+{
+	int w, h;
+	if (SDL_GetRendererOutputSize(renderer, &w, &h) != 0) return 1.0;
+	return SDL_min((float) w / SCREEN_WIDTH, (float) h / SCREEN_HEIGHT);
+}
+
+void render_scale_update_target(Render_Scale * rs, SDL_Renderer * renderer)
+{
+	float scale = rs->scale;
+	if (rs->native) {
+		rs->max_scale = render_scale_native(renderer);
+		// The budget starts from the window size and then moves freely
+		if (rs->budget <= 0.0 || !rs->target) {
+			scale = rs->max_scale;
+		}
+	}
+	scale = SDL_min(SDL_max(scale, RENDER_SCALE_MIN), SDL_min(rs->max_scale, RENDER_SCALE_MAX));
+	rs->scale = scale;
+	int w = SDL_max((int) (SCREEN_WIDTH * scale), 1);
+	int h = SDL_max((int) (SCREEN_HEIGHT * scale), 1);
+	if (rs->target && w == rs->target_w && h == rs->target_h) return;
+	if (rs->target) {
+		SDL_DestroyTexture(rs->target);
+	}
+	// The hint is read when a texture is made; only the target gets it
+	const char * hint = SDL_GetHint(SDL_HINT_RENDER_SCALE_QUALITY);
+	char previous[32];
+	snprintf(previous, sizeof(previous), "%s", hint ? hint : "nearest");
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, rs->filter);
+	rs->target = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h);
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, previous);
+	rs->target_w = w;
+	rs->target_h = h;
+}
+
+// Call before clearing a frame that will be drawn
+void render_scale_begin(Render_Scale * rs, SDL_Renderer * renderer)
+{
+	if (!rs->enabled) return;
+	rs->started = SDL_GetPerformanceCounter();
+	render_scale_update_target(rs, renderer);
+	if (!rs->target) return;
+	SDL_SetRenderTarget(renderer, rs->target);
+	SDL_RenderSetScale(renderer, (float) rs->target_w / SCREEN_WIDTH, (float) rs->target_h / SCREEN_HEIGHT);
+}
+
+// Call before SDL_RenderPresent
+void render_scale_end(Render_Scale * rs, SDL_Renderer * renderer)
+{
+	if (!rs->enabled || !rs->target) return;
+	// Back to the window, with its logical size
+	SDL_SetRenderTarget(renderer, NULL);
+	SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xff);
+	SDL_RenderClear(renderer);
+	SDL_RenderCopy(renderer, rs->target, NULL, NULL);
+}
+
+// Call right before SDL_RenderPresent, after render_scale_end
+void render_scale_rendered(Render_Scale * rs)
+{
+	if (!rs->enabled || rs->budget <= 0.0) return;
+	double cost = (SDL_GetPerformanceCounter() - rs->started) / (double) SDL_GetPerformanceFrequency();
+	rs->cost = rs->cost > 0.0 ? rs->cost * 0.9 + cost * 0.1 : cost;
+	if (rs->settle > 0) {
+		rs->settle--;
+		return;
+	}
+	if (rs->cost > rs->budget) {
+		rs->scale -= RENDER_SCALE_STEP;
+		rs->settle = RENDER_SCALE_SETTLE;
+	} else if (rs->cost < rs->budget * RENDER_SCALE_HEADROOM && rs->scale < rs->max_scale) {
+		rs->scale += RENDER_SCALE_STEP;
+		rs->settle = RENDER_SCALE_SETTLE;
+	}
+}
+
+// Window coordinates to the layout's. Call while the window is the
+// render target: the logical size gives it a scale, and a viewport in
+// layout coordinates offset by the letterbox.
+void render_scale_mouse(Render_Scale * rs, SDL_Renderer * renderer, int * x, int * y)
+{
+	if (!rs->enabled) return;
+	SDL_Rect viewport;
+	float sx, sy;
+	SDL_RenderGetViewport(renderer, &viewport);
+	SDL_RenderGetScale(renderer, &sx, &sy);
+	if (sx <= 0.0 || sy <= 0.0) return;
+	*x = (int) (*x / sx - viewport.x);
+	*y = (int) (*y / sy - viewport.y);
+}
+// //
+
+// //
+// Renderer selection
+// The first launch times a frame like the playing screen's, a full
+// screen background, PROBE_SPRITES blended sprites and a line, on
+// every render driver SDL has, and keeps the fastest. Its name goes in
+// RENDERER_CACHE_PATH, and later launches use it straight away. A
+// cached driver that has gone away or fails to start is probed again.
+#define RENDERER_CACHE_PATH "renderer.cfg"
+#define PROBE_SPRITES       30
+#define PROBE_WARMUP_FRAMES 5
+#define PROBE_FRAMES        30
+
+// -1 when SDL has no driver by that name with all of required_flags
+int renderer_driver_index(const char * name, uint32_t required_flags)
+{
+	for (int i = 0; i < SDL_GetNumRenderDrivers(); i++) {
+		SDL_RendererInfo info;
+		if (SDL_GetRenderDriverInfo(i, &info) == 0 && strcmp(info.name, name) == 0 &&
+			(info.flags & required_flags) == required_flags) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool renderer_cache_read(char * name, int size)
+{
+	FILE * file = fopen(RENDERER_CACHE_PATH, "r");
+	if (!file) return false;
+	char format[32];
+	snprintf(format, sizeof(format), "renderer %%%ds", size - 1);
+	bool read = fscanf(file, format, name) == 1;
+	fclose(file);
+	return read;
+}
+
+void renderer_cache_write(const char * name)
+{
+	FILE * file = fopen(RENDERER_CACHE_PATH, "w");
+	if (!file) {
+		fprintf(stderr, "Could not write %s\n", RENDERER_CACHE_PATH);
+		return;
+	}
+	fprintf(file, "renderer %s\n", name);
+	fclose(file);
+}
+
+// Opaque when alpha is false, otherwise a soft-edged disc like a sprite
+SDL_Texture * probe_texture(SDL_Renderer * renderer, int w, int h, bool alpha)
+{
+	SDL_Surface * surface = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888);
+	if (!surface) return NULL;
+	for (int y = 0; y < h; y++) {
+		uint32_t * row = (uint32_t*) ((uint8_t*) surface->pixels + y * surface->pitch);
+		for (int x = 0; x < w; x++) {
+			uint32_t a = 0xff;
+			if (alpha) {
+				float dx = (x - w / 2.0) / (w / 2.0), dy = (y - h / 2.0) / (h / 2.0);
+				a = (uint32_t) (fclamp(1.0 - (dx * dx + dy * dy), 0.0, 1.0) * 0xff);
+			}
+			row[x] = (a << 24) | ((x * 255 / w) << 16) | ((y * 255 / h) << 8) | 0x80;
+		}
+	}
+	SDL_Texture * texture = SDL_CreateTextureFromSurface(renderer, surface);
+	SDL_FreeSurface(surface);
+	if (texture && alpha) {
+		SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+	}
+	return texture;
+}
+
+// Seconds per frame, or a negative number if the driver didn't work.
+// Vsync is left out of flags here, as it would tie every driver at the
+// refresh rate.
+double renderer_probe(SDL_Window * window, int index, uint32_t flags)
+{
+	SDL_Renderer * renderer = SDL_CreateRenderer(window, index, flags & ~SDL_RENDERER_PRESENTVSYNC);
+	if (!renderer) return -1.0;
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+	SDL_Texture * bg = probe_texture(renderer, SCREEN_WIDTH, SCREEN_HEIGHT, false);
+	SDL_Texture * sprite = probe_texture(renderer, UI_INGRED_SIZE, UI_INGRED_SIZE, true);
+	double seconds = -1.0;
+	if (bg && sprite) {
+		uint64_t start = 0;
+		for (int frame = 0; frame < PROBE_WARMUP_FRAMES + PROBE_FRAMES; frame++) {
+			if (frame == PROBE_WARMUP_FRAMES) {
+				start = SDL_GetPerformanceCounter();
+			}
+			SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xff);
+			SDL_RenderClear(renderer);
+			SDL_RenderCopy(renderer, bg, NULL, NULL);
+			for (int i = 0; i < PROBE_SPRITES; i++) {
+				SDL_Rect rect = make_SDL_Rect((i * 131 + frame * 7) % (SCREEN_WIDTH - UI_INGRED_SIZE),
+											  (i * 71 + frame * 3) % (SCREEN_HEIGHT - UI_INGRED_SIZE),
+											  UI_INGRED_SIZE, UI_INGRED_SIZE);
+				SDL_RenderCopy(renderer, sprite, NULL, &rect);
+			}
+			SDL_SetRenderDrawColor(renderer, 0xff, 0xff, 0xff, 0xff);
+			SDL_RenderDrawLine(renderer, 0, frame, SCREEN_WIDTH, SCREEN_HEIGHT - frame);
+			SDL_RenderPresent(renderer);
+		}
+		// Reading a pixel back waits for the GPU to catch up
+		uint32_t pixel;
+		SDL_Rect one = make_SDL_Rect(0, 0, 1, 1);
+		SDL_RenderReadPixels(renderer, &one, SDL_PIXELFORMAT_ARGB8888, &pixel, sizeof(pixel));
+		seconds = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency() / PROBE_FRAMES;
+	}
+	if (bg) SDL_DestroyTexture(bg);
+	if (sprite) SDL_DestroyTexture(sprite);
+	SDL_DestroyRenderer(renderer);
+	return seconds;
+}
+
+// Index of the fastest driver with all of required_flags, or -1
+int renderer_probe_all(SDL_Window * window, uint32_t required_flags, uint32_t flags)
+{
+	int best = -1;
+	double best_seconds = 0.0;
+	for (int i = 0; i < SDL_GetNumRenderDrivers(); i++) {
+		SDL_RendererInfo info;
+		if (SDL_GetRenderDriverInfo(i, &info) != 0 || (info.flags & required_flags) != required_flags) {
+			continue;
+		}
+		double seconds = renderer_probe(window, i, flags);
+		if (seconds < 0.0) {
+			fprintf(stderr, "Renderer %s: failed\n", info.name);
+			continue;
+		}
+		fprintf(stderr, "Renderer %s: %.2f ms a frame\n", info.name, seconds * 1000.0);
+		if (best == -1 || seconds < best_seconds) {
+			best = i;
+			best_seconds = seconds;
+		}
+	}
+	return best;
+}
+
+// forced names a driver to use without probing; reprobe ignores the
+// cache. flags are passed on to SDL_CreateRenderer.
+SDL_Renderer * renderer_create(SDL_Window * window, const char * forced, bool reprobe,
+							   uint32_t required_flags, uint32_t flags)
+{
+	char cached[64];
+	const char * name = forced;
+	if (!name && !reprobe && renderer_cache_read(cached, sizeof(cached))) {
+		name = cached;
+	}
+	if (name) {
+		int index = renderer_driver_index(name, required_flags);
+		SDL_Renderer * renderer = index >= 0 ? SDL_CreateRenderer(window, index, flags) : NULL;
+		if (renderer) return renderer;
+		fprintf(stderr, "Renderer %s is not available\n", name);
+	}
+	int best = renderer_probe_all(window, required_flags, flags);
+	if (best == -1) {
+		return SDL_CreateRenderer(window, -1, flags);
+	}
+	SDL_Renderer * renderer = SDL_CreateRenderer(window, best, flags);
+	SDL_RendererInfo info;
+	if (renderer && !forced && SDL_GetRenderDriverInfo(best, &info) == 0) {
+		renderer_cache_write(info.name);
+	}
+	return renderer ? renderer : SDL_CreateRenderer(window, -1, flags);
+}
+// //
+
+// //
+// Pipelined play
+// With --pipelined, State_Playing is stepped on its own thread at a
+// fixed tick while the main thread handles events, renders and
+// presents. The simulation publishes a Playing_Snapshot after every
+// batch of ticks into a triple buffer, and the renderer always draws the
+// newest one, so neither side ever waits on the other.
+#define PIPELINE_TICK  (1.0 / 120.0)
+// Never simulate more than this much at once after a stall
+#define PIPELINE_MAX_CATCH_UP 0.25
+// Set in Pipeline.latest when the simulation has published a snapshot
+// the renderer hasn't taken yet
+#define PIPELINE_FRESH 4
+
+typedef struct {
+	// The simulation's own copy, so the main thread can keep writing
+	// the mouse position and frame time into its Engine
+	Engine engine;
+	State_Playing * state;
+	// Only touched by the simulation while it runs
+	Rewind_Ring * rewind;
+	SDL_Thread * thread;
+	SDL_atomic_t running;
+	// Playing_Msg the simulation stopped with, PLAYING_OK while running
+	SDL_atomic_t finished;
+	// Handed over by the main thread
+	SDL_mutex * lock;
+	SDL_Event * events;
+	int mouse_x;
+	int mouse_y;
+	float time_scale;
+	// Triple buffer
+	Playing_Snapshot snapshots[3];
+	SDL_atomic_t latest;
+	int back;
+	int front;
+} Pipeline;
+
+void pipeline_publish(Pipeline * pipeline)
+{
+	playing_snapshot_take(pipeline->state, &pipeline->snapshots[pipeline->back]);
+	pipeline->back = SDL_AtomicSet(&pipeline->latest, pipeline->back | PIPELINE_FRESH) & ~PIPELINE_FRESH;
+}
+
+int pipeline_thread(void * data)
+{
+	Pipeline * pipeline = (Pipeline*) data;
+	Engine * engine = &pipeline->engine;
+	SDL_Event * events = NULL;
+	uint64_t frequency = SDL_GetPerformanceFrequency();
+	uint64_t last = SDL_GetPerformanceCounter();
+	double pending = 0.0;
+	engine->sdl.delta_time = PIPELINE_TICK;
+	while (SDL_AtomicGet(&pipeline->running)) {
+		// The tick stays the same, time scale only changes how many run
+		SDL_LockMutex(pipeline->lock);
+		double scale = pipeline->time_scale;
+		SDL_UnlockMutex(pipeline->lock);
+		uint64_t now = SDL_GetPerformanceCounter();
+		pending = SDL_min(pending + (double) (now - last) / frequency * scale,
+						  PIPELINE_MAX_CATCH_UP * scale);
+		last = now;
+		if (pending < PIPELINE_TICK) {
+			SDL_Delay(1);
+			continue;
+		}
+
+		Playing_Msg msg = PLAYING_OK;
+		while (pending >= PIPELINE_TICK && msg == PLAYING_OK) {
+			pending -= PIPELINE_TICK;
+			// Swap event lists so the main thread is never held up
+			SDL_LockMutex(pipeline->lock);
+			SDL_Event * incoming = pipeline->events;
+			pipeline->events = events;
+			events = incoming;
+			engine->sdl.mouse_x = pipeline->mouse_x;
+			engine->sdl.mouse_y = pipeline->mouse_y;
+			SDL_UnlockMutex(pipeline->lock);
+
+			for (int i = 0; i < sb_count(events); i++) {
+				session_record_event(events[i]);
+				state_playing_event(engine, pipeline->state, events[i]);
+			}
+			if (events) {
+				stb__sbn(events) = 0;
+			}
+			msg = state_playing_step(engine, pipeline->state, pipeline->rewind, PIPELINE_TICK);
+			session_record_frame(engine, PIPELINE_TICK);
+		}
+		pipeline_publish(pipeline);
+		if (msg != PLAYING_OK) {
+			SDL_AtomicSet(&pipeline->finished, msg);
+			break;
+		}
+	}
+	sb_free(events);
+	return 0;
+}
+
+void pipeline_start(Pipeline * pipeline, Engine * engine, State_Playing * state, Rewind_Ring * rewind)
+{
+	pipeline->engine = *engine;
+	pipeline->state = state;
+	pipeline->rewind = rewind;
+	pipeline->lock = SDL_CreateMutex();
+	pipeline->events = NULL;
+	pipeline->mouse_x = engine->sdl.mouse_x;
+	pipeline->mouse_y = engine->sdl.mouse_y;
+	pipeline->time_scale = engine->time_scale;
+	pipeline->back = 0;
+	pipeline->front = 1;
+	SDL_AtomicSet(&pipeline->latest, 2);
+	playing_snapshot_take(state, &pipeline->snapshots[pipeline->front]);
+	SDL_AtomicSet(&pipeline->finished, PLAYING_OK);
+	SDL_AtomicSet(&pipeline->running, 1);
+	pipeline->thread = SDL_CreateThread(pipeline_thread, "simulation", pipeline);
+}
+
+void pipeline_stop(Pipeline * pipeline)
+{
+	if (!pipeline->thread) return;
+	SDL_AtomicSet(&pipeline->running, 0);
+	SDL_WaitThread(pipeline->thread, NULL);
+	pipeline->thread = NULL;
+	SDL_DestroyMutex(pipeline->lock);
+	sb_free(pipeline->events);
+}
+
+// Call from the main thread once per frame, after polling events
+void pipeline_push(Pipeline * pipeline, SDL_Event * events, int mouse_x, int mouse_y, float time_scale)
+{
+	SDL_LockMutex(pipeline->lock);
+	for (int i = 0; i < sb_count(events); i++) {
+		sb_push(pipeline->events, events[i]);
+	}
+	pipeline->mouse_x = mouse_x;
+	pipeline->mouse_y = mouse_y;
+	pipeline->time_scale = time_scale;
+	SDL_UnlockMutex(pipeline->lock);
+}
+
+Playing_Msg pipeline_finished(Pipeline * pipeline)
+{
+	return (Playing_Msg) SDL_AtomicGet(&pipeline->finished);
+}
+
+// Draws the newest published snapshot. The dragged ingredient follows
+// the main thread's mouse, which is fresher than the simulation's.
+void pipeline_render(Engine * engine, Pipeline * pipeline)
+{
+	if (SDL_AtomicGet(&pipeline->latest) & PIPELINE_FRESH) {
+		pipeline->front = SDL_AtomicSet(&pipeline->latest, pipeline->front) & ~PIPELINE_FRESH;
+	}
+	playing_snapshot_render(engine, pipeline->state, &pipeline->snapshots[pipeline->front]);
+}
+// //
+
+// //
+// Session export
+// Re-simulates a recorded session and renders it offscreen as a Y4M
+// stream or a numbered BMP sequence at a fixed frame rate. The output
+// frames can be split between several processes: each one is forked
+// from a simulation-only replay once it reaches the start of its range.
+#define EXPORT_FPS 60
+#define EXPORT_MAX_BANDS 64
+
+typedef enum {
+	EXPORT_Y4M,
+	EXPORT_BMP,
+} Export_Format;
+
+typedef struct {
+	Session * session;
+	Export_Format format;
+	// File for Y4M, printf-style pattern with %d for BMP
+	char * out_path;
+} Export_Job;
+
+int export_frame_count(Session * session)
+{
+	return (int) floor(session->duration * EXPORT_FPS) + 1;
+}
+
+void export_write_y4m_header(FILE * file)
+{
+	fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+			SCREEN_WIDTH, SCREEN_HEIGHT, EXPORT_FPS);
+}
+
+typedef struct {
+	SDL_Surface * frame;
+	uint8_t (*planes)[SCREEN_WIDTH * SCREEN_HEIGHT];
+	int first_row;
+	int last_row;
+} Export_Band;
+
+void export_convert_band(void * data)
+{
+	Export_Band * band = (Export_Band*) data;
+	SDL_Surface * frame = band->frame;
+	uint8_t (*planes)[SCREEN_WIDTH * SCREEN_HEIGHT] = band->planes;
+	for (int y = band->first_row; y < band->last_row; y++) {
+		uint32_t * row = (uint32_t*) ((uint8_t*) frame->pixels + y * frame->pitch);
+		for (int x = 0; x < SCREEN_WIDTH; x++) {
+			int r = (row[x] >> 16) & 0xff, g = (row[x] >> 8) & 0xff, b = row[x] & 0xff;
+			// BT.601, studio range
+			planes[0][y * SCREEN_WIDTH + x] = (( 66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
+			planes[1][y * SCREEN_WIDTH + x] = ((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+			planes[2][y * SCREEN_WIDTH + x] = ((112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+		}
+	}
+}
+
+// The conversion is split into bands of rows across the job system
+void export_write_y4m_frame(Engine * engine, FILE * file, SDL_Surface * frame)
+{
+	static uint8_t planes[3][SCREEN_WIDTH * SCREEN_HEIGHT];
+	Export_Band bands[EXPORT_MAX_BANDS];
+	int band_count = SDL_min(jobs_worker_count(engine->jobs) + 1, EXPORT_MAX_BANDS);
+	Job_Counter converted;
+	jobs_counter_init(&converted);
+	for (int i = 0; i < band_count; i++) {
+		bands[i] = (Export_Band) {
+			frame, planes, SCREEN_HEIGHT * i / band_count, SCREEN_HEIGHT * (i + 1) / band_count,
+		};
+		jobs_run(engine->jobs, export_convert_band, &bands[i], JOB_ANY_THREAD, NULL, &converted);
+	}
+	jobs_wait(engine->jobs, &converted);
+	fputs("FRAME\n", file);
+	fwrite(planes, 1, sizeof(planes), file);
+}
+
+// A replay of the session's simulation, without rendering, that can
+// stop before any output frame
+typedef struct {
+	State_Playing * state;
+	// Rewinds are replayed like any other input
+	Rewind_Ring * rewind;
+	int frame;
+	int event_index;
+	double time;
+	// Next output frame due
+	int video_frame;
+} Export_Replay;
+
+void export_replay_start(Engine * engine, Export_Replay * replay, Session * session)
+{
+	replay->state = (State_Playing*) calloc(1, sizeof(State_Playing));
+	engine->difficulty = session->header.difficulty;
+	engine->fixed_point = session->header.magic == SESSION_MAGIC_FIXED;
+	state_playing_init(engine, replay->state, session->header.seed);
+	replay->rewind = rewind_create();
+	replay->frame = 0;
+	replay->event_index = 0;
+	replay->time = 0.0;
+	replay->video_frame = 0;
+}
+
+void export_replay_free(Export_Replay * replay)
+{
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		if (replay->state->table_orders[t]) sb_free(replay->state->table_orders[t]);
+	}
+	free(replay->state);
+	rewind_free(replay->rewind);
+}
+
+// Steps one session frame. False once the session is over.
+bool export_replay_step(Engine * engine, Export_Replay * replay, Session * session)
+{
+	if (replay->frame >= sb_count(session->frames)) return false;
+	Session_Frame * frame = &session->frames[replay->frame++];
+	engine->sdl.mouse_x = frame->mouse_x;
+	engine->sdl.mouse_y = frame->mouse_y;
+	for (int e = 0; e < frame->event_count; e++) {
+		state_playing_event(engine, replay->state,
+			session_event_to_sdl(session->events[replay->event_index++]));
+	}
+	engine->sdl.delta_time = frame->delta_time;
+	if (state_playing_step(engine, replay->state, replay->rewind, engine->sdl.delta_time) != PLAYING_OK) {
+		// Pin the replay so no more frames come due
+		replay->frame = sb_count(session->frames);
+		return false;
+	}
+	replay->time += frame->delta_time;
+	return true;
+}
+
+// The next output frame shows the current state
+bool export_replay_due(Export_Replay * replay)
+{
+	return replay->frame > 0 && (double) replay->video_frame / EXPORT_FPS <= replay->time;
+}
+
+// Steps until the next output frame due is first
+void export_replay_skip(Engine * engine, Export_Replay * replay, Session * session, int first)
+{
+	while (replay->video_frame < first) {
+		if (export_replay_due(replay)) {
+			replay->video_frame++;
+		} else if (!export_replay_step(engine, replay, session)) {
+			return;
+		}
+	}
+}
+
+// Renders output frames up to last into file (Y4M frames, no header)
+// or into the BMP sequence, continuing the replay
+bool export_range(Engine * engine, Export_Job * job, Export_Replay * replay, int last, FILE * file)
+{
+	State_Playing * state = replay->state;
+	state_playing_load_textures(engine, state);
+	while (replay->video_frame <= last) {
+		if (!export_replay_due(replay)) {
+			if (!export_replay_step(engine, replay, job->session)) break;
+			continue;
+		}
+		SDL_SetRenderDrawColor(engine->sdl.renderer, 0x00, 0x00, 0x00, 0xff);
+		render_clear(engine);
+		state_playing_render(engine, state);
+		while (replay->video_frame <= last && export_replay_due(replay)) {
+			if (job->format == EXPORT_Y4M) {
+				export_write_y4m_frame(engine, file, engine->sdl.frame);
+			} else {
+				char buffer[512];
+				snprintf(buffer, sizeof(buffer), job->out_path, replay->video_frame);
+				if (SDL_SaveBMP(engine->sdl.frame, buffer) != 0) {
+					fprintf(stderr, "Could not save %s: %s\n", buffer, SDL_GetError());
+					return false;
+				}
+			}
+			replay->video_frame++;
+		}
+	}
+	return true;
+}
+
+bool export_part_path(char * buffer, int size, char * out_path, int part)
+{
+	return snprintf(buffer, size, "%s.part%d", out_path, part) < size;
+}
+
+bool export_copy_file(FILE * out, char * path)
+{
+	FILE * in = fopen(path, "rb");
+	if (!in) return false;
+	char buffer[1 << 16];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+		fwrite(buffer, 1, read, out);
+	}
+	fclose(in);
+	return true;
+}
+
+int export_session(char * session_path, char * out_path, int jobs)
+{
+	Session session;
+	if (!session_load(&session, session_path)) {
+		fprintf(stderr, "Could not load session %s\n", session_path);
+		return 1;
+	}
+	Export_Job job;
+	job.session = &session;
+	job.out_path = out_path;
+	char * extension = strrchr(out_path, '.');
+	if (extension && strcmp(extension, ".y4m") == 0) {
+		job.format = EXPORT_Y4M;
+	} else if (strchr(out_path, '%')) {
+		job.format = EXPORT_BMP;
+	} else {
+		fprintf(stderr, "Output must be a .y4m file or a BMP pattern like frames/%%06d.bmp\n");
+		return 1;
+	}
+
+	int frames = export_frame_count(&session);
+#ifdef _WIN32
+	jobs = 1;
+#endif
+	if (jobs < 1) jobs = 1;
+	if (jobs > frames) jobs = frames;
+
+	if (jobs == 1) {
+		FILE * file = NULL;
+		if (job.format == EXPORT_Y4M) {
+			file = fopen(out_path, "wb");
+			if (!file) return 1;
+			export_write_y4m_header(file);
+		}
+		Engine engine;
+		engine_init(&engine);
+		engine.jobs = jobs_create(-1);
+		Export_Replay replay;
+		export_replay_start(&engine, &replay, &session);
+		bool ok = headless_init(&engine) && export_range(&engine, &job, &replay, frames - 1, file);
+		export_replay_free(&replay);
+		jobs_destroy(engine.jobs);
+		if (file) fclose(file);
+		return ok ? 0 : 1;
+	}
+
+	bool ok = true;
+#ifndef _WIN32
+	// The parent only simulates, and forks one process per range as the
+	// replay reaches its first frame. Each child starts from that copy of
+	// the state and owns its own renderer, since SDL is never touched
+	// before the fork.
+	Engine engine;
+	engine_init(&engine);
+	Export_Replay replay;
+	export_replay_start(&engine, &replay, &session);
+	pid_t * children = NULL;
+	for (int part = 0; part < jobs; part++) {
+		int first = (int) ((int64_t) frames * part / jobs);
+		int last = (int) ((int64_t) frames * (part + 1) / jobs) - 1;
+		export_replay_skip(&engine, &replay, &session, first);
+		pid_t pid = fork();
+		if (pid == 0) {
+			FILE * file = NULL;
+			if (job.format == EXPORT_Y4M) {
+				char buffer[512];
+				export_part_path(buffer, sizeof(buffer), out_path, part);
+				file = fopen(buffer, "wb");
+				if (!file) _exit(1);
+			}
+			bool ok = headless_init(&engine) && export_range(&engine, &job, &replay, last, file);
+			if (file) fclose(file);
+			_exit(ok ? 0 : 1);
+		}
+		sb_push(children, pid);
+	}
+	export_replay_free(&replay);
+	for (int i = 0; i < sb_count(children); i++) {
+		int status;
+		waitpid(children[i], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			ok = false;
+		}
+	}
+	sb_free(children);
+
+	if (job.format == EXPORT_Y4M) {
+		FILE * file = ok ? fopen(out_path, "wb") : NULL;
+		if (file) export_write_y4m_header(file);
+		for (int part = 0; part < jobs; part++) {
+			char buffer[512];
+			export_part_path(buffer, sizeof(buffer), out_path, part);
+			if (file && !export_copy_file(file, buffer)) ok = false;
+			remove(buffer);
+		}
+		if (file) fclose(file);
+		else ok = false;
+	}
+#endif
+	return ok ? 0 : 1;
+}
+// //
+
+enum Game_State {
+	STATE_PLAYING,
+	STATE_MAIN_MENU,
+};
+
+// States stay allocated, with their textures, for the whole run. A
+// state is initialized the first time it is entered, suspended while
+// another is pushed on top, and resumed when it is back on top.
+typedef struct {
+	enum Game_State type;
+	// Initialized, so entering it again resumes
+	bool resident;
+	union {
+		State_Playing   state_playing;
+		State_Main_Menu state_main_menu;
+	};
+} Game_State;
+
+// //
+// Render regression benchmark
+// Renders a fixed list of scenes offscreen, hashes every frame and
+// compares the hashes with a goldens file, then times repeated renders
+// of each scene. A render optimization is correct when every hash still
+// matches, and the timings show what it bought.
+#define BENCH_SEED       1234
+#define BENCH_ITERATIONS  200
+
+typedef struct {
+	char * name;
+	enum Game_State type;
+	float slider;
+	void (*setup)(Engine * engine, State_Playing * state);
+} Bench_Scene;
+
+void bench_set_order(State_Playing * state, int table, God god, int count)
+{
+	state->tables[table] = god;
+	for (int i = 0; i < count; i++) {
+		sb_push(state->table_orders[table], (Ingredient) (INGRED_UNCOOKED_COUNT + (table + i) % INGRED_UNCOOKED_COUNT));
+	}
+}
+
+void bench_setup_tables_full(Engine * engine, State_Playing * state)
+{
+	for (int i = 0; i < UI_TABLE_COUNT; i++) {
+		bench_set_order(state, i, (God) (i * 2), 3);
+	}
+	timer_wheel_cancel(&state->timers, state->spawn_timer);
+	state->spawn_timer = playing_schedule(state, 2.5, PLAYING_TIMER_SPAWN, 0);
+	state->god_spawn_this_reset = 10.0;
+}
+
+void bench_setup_burnt_fires(Engine * engine, State_Playing * state)
+{
+	bench_set_order(state, 0, GOD_ZEUS, 2);
+	bench_set_order(state, 3, GOD_VENUS, 1);
+	state->fires[0].in_fire = INGRED_GOAT_BURNT;
+	state->fires[1].in_fire = INGRED_ISAAC_BURNT;
+	state->fires[1].frame = 1;
+	state->transient_ingredient = INGRED_LAMB;
+	engine->sdl.mouse_x = 300;
+	engine->sdl.mouse_y = 420;
+}
+
+void bench_setup_death(Engine * engine, State_Playing * state)
+{
+	state->lost = true;
+	state->time_spent = 123.0;
+}
+
+Bench_Scene bench_scenes[] = {
+	{ "menu-slider-0.0", STATE_MAIN_MENU, 0.0, NULL },
+	{ "menu-slider-0.5", STATE_MAIN_MENU, 0.5, NULL },
+	{ "menu-slider-1.0", STATE_MAIN_MENU, 1.0, NULL },
+	{ "playing-empty",       STATE_PLAYING, 0.0, NULL },
+	{ "playing-tables-full", STATE_PLAYING, 0.0, bench_setup_tables_full },
+	{ "playing-burnt-fires", STATE_PLAYING, 0.0, bench_setup_burnt_fires },
+	{ "playing-death",       STATE_PLAYING, 0.0, bench_setup_death },
+};
+#define BENCH_SCENE_COUNT (sizeof(bench_scenes) / sizeof(bench_scenes[0]))
+
+// FNV-1a over the visible pixels of the headless frame
+uint64_t bench_hash_frame(SDL_Surface * frame)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	for (int y = 0; y < frame->h; y++) {
+		uint8_t * row = (uint8_t*) frame->pixels + y * frame->pitch;
+		for (int x = 0; x < frame->w * 4; x++) {
+			hash ^= row[x];
+			hash *= 0x100000001b3;
+		}
+	}
+	return hash;
+}
+
+void bench_render_scene(Engine * engine, Bench_Scene * scene, Game_State * menu, Game_State * playing)
+{
+	SDL_SetRenderDrawColor(engine->sdl.renderer, 0x00, 0x00, 0x00, 0xff);
+	render_clear(engine);
+	if (scene->type == STATE_MAIN_MENU) {
+		state_main_menu_render(engine, &menu->state_main_menu);
+	} else {
+		state_playing_render(engine, &playing->state_playing);
+	}
+	SDL_RenderPresent(engine->sdl.renderer);
+}
+
+bool bench_find_golden(char * goldens_path, char * name, uint64_t * hash)
+{
+	FILE * file = fopen(goldens_path, "r");
+	if (!file) return false;
+	char line_name[256];
+	unsigned long long line_hash;
+	bool found = false;
+	while (fscanf(file, "%255s %llx", line_name, &line_hash) == 2) {
+		if (strcmp(line_name, name) == 0) {
+			*hash = line_hash;
+			found = true;
+			break;
+		}
+	}
+	fclose(file);
+	return found;
+}
+
+int render_bench(char * goldens_path, bool update_goldens, int iterations)
+{
+	Engine * engine = (Engine*) malloc(sizeof(Engine));
+	engine_init(engine);
+	if (!headless_init(engine)) {
+		return 1;
+	}
+	Game_State * menu = (Game_State*) malloc(sizeof(Game_State));
+	menu->type = STATE_MAIN_MENU;
+	state_main_menu_init(engine, &menu->state_main_menu);
+	state_main_menu_load_textures(engine, &menu->state_main_menu);
+	Game_State * playing = (Game_State*) calloc(1, sizeof(Game_State));
+	playing->type = STATE_PLAYING;
+	state_playing_load_textures(engine, &playing->state_playing);
+	state_playing_reset(engine, &playing->state_playing, BENCH_SEED);
+
+	uint64_t hashes[BENCH_SCENE_COUNT];
+	int failures = 0;
+	double total_time = 0.0;
+	printf("%-22s %-18s %-8s %10s %10s\n", "scene", "hash", "golden", "mean us", "min us");
+	for (int i = 0; i < BENCH_SCENE_COUNT; i++) {
+		Bench_Scene * scene = &bench_scenes[i];
+		engine->sdl.mouse_x = 0;
+		engine->sdl.mouse_y = 0;
+		if (scene->type == STATE_MAIN_MENU) {
+			menu->state_main_menu.slider = scene->slider;
+			state_main_menu_update(engine, &menu->state_main_menu);
+		} else {
+			State_Playing * state = &playing->state_playing;
+			state_playing_reset(engine, state, BENCH_SEED);
+			if (scene->setup) {
+				scene->setup(engine, state);
+			}
+		}
+
+		bench_render_scene(engine, scene, menu, playing);
+		hashes[i] = bench_hash_frame(engine->sdl.frame);
+
+		char * status = "new";
+		uint64_t golden;
+		if (!update_goldens) {
+			// A scene without a golden is unchecked, which fails the run too
+			if (!bench_find_golden(goldens_path, scene->name, &golden)) {
+				status = "MISSING";
+				failures++;
+			} else if (golden == hashes[i]) {
+				status = "ok";
+			} else {
+				status = "MISMATCH";
+				failures++;
+			}
+		}
+
+		double sum = 0.0, min = 1e9;
+		for (int n = 0; n < iterations; n++) {
+			uint64_t start = SDL_GetPerformanceCounter();
+			bench_render_scene(engine, scene, menu, playing);
+			double us = (double) (SDL_GetPerformanceCounter() - start) * 1e6 / SDL_GetPerformanceFrequency();
+			sum += us;
+			if (us < min) min = us;
+		}
+		total_time += sum;
+		printf("%-22s %016llx %-8s %10.1f %10.1f\n", scene->name, (unsigned long long) hashes[i],
+			   status, sum / iterations, min);
+	}
+	printf("total render time %.1f ms over %d iterations per scene\n", total_time / 1000.0, iterations);
+
+	if (update_goldens) {
+		FILE * file = fopen(goldens_path, "w");
+		if (!file) {
+			fprintf(stderr, "Could not write %s\n", goldens_path);
+			return 1;
+		}
+		for (int i = 0; i < BENCH_SCENE_COUNT; i++) {
+			fprintf(file, "%s %016llx\n", bench_scenes[i].name, (unsigned long long) hashes[i]);
+		}
+		fclose(file);
+		printf("wrote %s\n", goldens_path);
+	}
+	if (failures > 0) {
+		fprintf(stderr, "%d scene(s) missing or mismatched in %s, rerun with --update-goldens to accept\n",
+				failures, goldens_path);
+	}
+	return failures > 0 ? 1 : 0;
+}
+// //
+
+// //
+// Scripted bot
+// Plays State_Playing through the same mouse handlers as a person,
+// one drag per action, so it can be used wherever sessions are
+// simulated without input.
+typedef struct {
+	// Seconds between actions, jittered by +-50%
+	float reaction_time;
+	// Chance that an action is a random drag onto a fire instead
+	float mistake_chance;
+} Bot_Config;
+
+typedef struct {
+	Bot_Config config;
+	Rng rng;
+	float cooldown;
+} Bot;
+
+#define BOT_REACTION_TIME  0.6
+#define BOT_MISTAKE_CHANCE 0.02
+
+void bot_init(Bot * bot, Bot_Config config, uint64_t seed)
+{
+	bot->config = config;
+	rng_seed(&bot->rng, seed, 0);
+	bot->cooldown = 0.0;
+}
+
+Vector2 rect_center(SDL_Rect rect)
+{
+	return make_Vector2(rect.x + rect.w / 2, rect.y + rect.h / 2);
+}
+
+void bot_drag(Engine * engine, State_Playing * state, SDL_Rect from, SDL_Rect to)
+{
+	state_playing_mbdown(engine, state, rect_center(from));
+	state_playing_mbup(engine, state, rect_center(to));
+}
+
+bool order_wanted(State_Playing * state, Ingredient cooked)
+{
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		if (state->tables[t] == GOD_NONE) continue;
+		for (int i = 0; i < sb_count(state->table_orders[t]); i++) {
+			if (state->table_orders[t][i] == cooked) return true;
+		}
+	}
+	return false;
+}
+
+void bot_act(Engine * engine, Bot * bot, State_Playing * state)
+{
+	if (rng_float(&bot->rng) < bot->config.mistake_chance) {
+		bot_drag(engine, state, ingredient_box(rng_range(&bot->rng, INGRED_UNCOOKED_COUNT)),
+				 fire_box(rng_range(&bot->rng, UI_FIRE_COUNT)));
+		return;
+	}
+	// Serve cooked food to whoever wants it next
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		Fire * fire = &state->fires[f];
+		if (fire->in_fire == INGRED_NONE || fire->cooking) continue;
+		for (int t = 0; t < UI_TABLE_COUNT; t++) {
+			if (state->tables[t] != GOD_NONE && sb_last(state->table_orders[t]) == fire->in_fire) {
+				bot_drag(engine, state, fire_box(f), table_box(t));
+				return;
+			}
+		}
+	}
+	// Throw away food nobody is waiting for
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		Fire * fire = &state->fires[f];
+		if (fire->in_fire == INGRED_NONE || fire->cooking) continue;
+		if (!order_wanted(state, fire->in_fire)) {
+			bot_drag(engine, state, fire_box(f), trash_box());
+			return;
+		}
+	}
+	// Start on what is needed soonest: the tops of all stacks first, then
+	// one deeper, skipping anything a fire already covers
+	int on_fire[INGRED_UNCOOKED_COUNT] = { 0 };
+	int empty_fire = -1;
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		Ingredient in_fire = state->fires[f].in_fire;
+		if (in_fire == INGRED_NONE) {
+			if (empty_fire == -1) empty_fire = f;
+		} else {
+			on_fire[in_fire % INGRED_UNCOOKED_COUNT]++;
+		}
+	}
+	if (empty_fire == -1) return;
+	for (int depth = 0; depth < 3; depth++) {
+		for (int t = 0; t < UI_TABLE_COUNT; t++) {
+			if (state->tables[t] == GOD_NONE) continue;
+			int i = sb_count(state->table_orders[t]) - 1 - depth;
+			if (i < 0) continue;
+			Ingredient raw = state->table_orders[t][i] - INGRED_UNCOOKED_COUNT;
+			if (on_fire[raw] > 0) {
+				on_fire[raw]--;
+				continue;
+			}
+			bot_drag(engine, state, ingredient_box(raw), fire_box(empty_fire));
+			return;
+		}
+	}
+}
+
+// Steps the bot's clock, acting when it runs out
+void bot_update(Engine * engine, Bot * bot, State_Playing * state, float delta_time)
+{
+	bot->cooldown -= delta_time;
+	if (bot->cooldown <= 0.0) {
+		bot_act(engine, bot, state);
+		bot->cooldown += bot->config.reaction_time * (0.5 + rng_float(&bot->rng));
+	}
+}
+// //
+
+// //
+// Difficulty tuner
+// Simulates many bot-played sessions for every point of a grid over the
+// spawn parameters, across all cores, and reports the distribution of
+// survival time at each point. Session n uses the same seed at every
+// grid point so the points are compared on identical games.
+#define TUNER_SESSIONS    10000
+#define TUNER_CHUNK         256
+#define TUNER_DELTA_TIME   0.05
+#define TUNER_MAX_TIME    600.0
+#define TUNER_AXIS_COUNT      5
+
+typedef struct {
+	double min;
+	double max;
+	int steps;
+} Tuner_Axis;
+
+typedef struct {
+	Tuner_Axis axes[TUNER_AXIS_COUNT];
+	int sessions;
+	float delta_time;
+	float max_time;
+	Bot_Config bot;
+	uint64_t seed;
+	int threads;
+	bool fixed_point;
+} Tuner_Options;
+
+char * tuner_axis_names[TUNER_AXIS_COUNT] = {
+	"difficulty", "sub_base_mult", "sub_mult_div", "minimum_spawn_time", "mst_div",
+};
+
+typedef struct {
+	Tuner_Options * options;
+	int points;
+	int chunks_per_point;
+	SDL_atomic_t chunks_done;
+	SDL_mutex * lock;
+	Quantile_Sketch * sketches;
+	// Sessions per point that lasted until max_time
+	uint64_t * survived;
+} Tuner;
+
+// "min:max:steps" or a single value
+bool tuner_parse_axis(Tuner_Axis * axis, char * spec)
+{
+	if (sscanf(spec, "%lf:%lf:%d", &axis->min, &axis->max, &axis->steps) == 3) {
+		return axis->steps >= 1;
+	}
+	if (sscanf(spec, "%lf", &axis->min) == 1) {
+		axis->max = axis->min;
+		axis->steps = 1;
+		return true;
+	}
+	return false;
+}
+
+Spawn_Params tuner_point_params(Tuner_Options * options, int point)
+{
+	double values[TUNER_AXIS_COUNT];
+	for (int i = TUNER_AXIS_COUNT - 1; i >= 0; i--) {
+		Tuner_Axis * axis = &options->axes[i];
+		int step = point % axis->steps;
+		point /= axis->steps;
+		values[i] = axis->steps == 1 ? axis->min :
+			axis->min + (axis->max - axis->min) * step / (axis->steps - 1);
+	}
+	return (Spawn_Params) { values[0], values[1], values[2], values[3], values[4] };
+}
+
+float tuner_run_session(Engine * engine, State_Playing * state, Spawn_Params params,
+						Tuner_Options * options, int session)
+{
+	uint64_t seed = options->seed + session;
+	Bot bot;
+	bot_init(&bot, options->bot, seed);
+	state_playing_reset(engine, state, (uint32_t) seed);
+	playing_set_spawn(state, params);
+	while (!state->lost && state->time_spent < options->max_time) {
+		bot_update(engine, &bot, state, options->delta_time);
+		state_playing_update(engine, state, options->delta_time);
+	}
+	return state->time_spent;
+}
+
+typedef struct {
+	Tuner * tuner;
+	int chunk;
+} Tuner_Chunk;
+
+// One job per chunk of sessions at one grid point
+void tuner_run_chunk(void * data)
+{
+	Tuner * tuner = ((Tuner_Chunk*) data)->tuner;
+	int chunk = ((Tuner_Chunk*) data)->chunk;
+	Tuner_Options * options = tuner->options;
+	Engine engine;
+	engine_init(&engine);
+	engine.fixed_point = options->fixed_point;
+	State_Playing * state = (State_Playing*) calloc(1, sizeof(State_Playing));
+	Quantile_Sketch * sketch = (Quantile_Sketch*) malloc(sizeof(Quantile_Sketch));
+	int total_chunks = tuner->points * tuner->chunks_per_point;
+	int point = chunk / tuner->chunks_per_point;
+	int first = (chunk % tuner->chunks_per_point) * TUNER_CHUNK;
+	int last = SDL_min(first + TUNER_CHUNK, options->sessions);
+	Spawn_Params params = tuner_point_params(options, point);
+
+	sketch_init(sketch);
+	uint64_t survived = 0;
+	for (int session = first; session < last; session++) {
+		float time = tuner_run_session(&engine, state, params, options, session);
+		sketch_add(sketch, time);
+		if (time >= options->max_time) survived++;
+	}
+
+	SDL_LockMutex(tuner->lock);
+	sketch_merge(&tuner->sketches[point], sketch);
+	tuner->survived[point] += survived;
+	SDL_UnlockMutex(tuner->lock);
+
+	int done = SDL_AtomicAdd(&tuner->chunks_done, 1) + 1;
+	if (done % 64 == 0 || done == total_chunks) {
+		fprintf(stderr, "\r%d / %d chunks", done, total_chunks);
+	}
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		sb_free(state->table_orders[t]);
+	}
+	free(sketch);
+	free(state);
+}
+
+void tuner_print_usage(char * program)
+{
+	fprintf(stderr,
+			"Usage: %s --tune [options]\n"
+			"Axes take min:max:steps or a single value:\n"
+			"  --difficulty --sub-base-mult --sub-mult-div --min-spawn-time --mst-div\n"
+			"  --sessions <n>        sessions per grid point (%d)\n"
+			"  --dt <seconds>        simulation step (%.2f)\n"
+			"  --max-time <seconds>  cut sessions off here (%.0f)\n"
+			"  --reaction <seconds>  bot time between actions (%.2f)\n"
+			"  --mistakes <chance>   bot chance of a random drag (%.2f)\n"
+			"  --seed <n>            first session seed\n"
+			"  --threads <n>         worker threads (all cores)\n"
+			"  --fixed               play on integer time\n",
+			program, TUNER_SESSIONS, TUNER_DELTA_TIME, TUNER_MAX_TIME,
+			BOT_REACTION_TIME, BOT_MISTAKE_CHANCE);
+}
+
+int tuner_main(int argc, char ** argv)
+{
+	Tuner_Options options;
+	Spawn_Params defaults = default_spawn_params(1.0);
+	double default_values[TUNER_AXIS_COUNT] = {
+		defaults.difficulty, defaults.sub_base_mult, defaults.sub_mult_div,
+		defaults.minimum_spawn_time, defaults.mst_div,
+	};
+	char * axis_flags[TUNER_AXIS_COUNT] = {
+		"--difficulty", "--sub-base-mult", "--sub-mult-div", "--min-spawn-time", "--mst-div",
+	};
+	for (int i = 0; i < TUNER_AXIS_COUNT; i++) {
+		options.axes[i] = (Tuner_Axis) { default_values[i], default_values[i], 1 };
+	}
+	options.axes[0] = (Tuner_Axis) { 1.0, DIFFICULTY_MULT, 11 };
+	options.sessions = TUNER_SESSIONS;
+	options.delta_time = TUNER_DELTA_TIME;
+	options.max_time = TUNER_MAX_TIME;
+	options.bot = (Bot_Config) { BOT_REACTION_TIME, BOT_MISTAKE_CHANCE };
+	options.seed = 1;
+	options.threads = SDL_GetCPUCount();
+	options.fixed_point = false;
+
+	for (int i = 2; i < argc; i++) {
+		bool parsed = false;
+		if (strcmp(argv[i], "--fixed") == 0) {
+			options.fixed_point = true;
+			continue;
+		}
+		if (i + 1 < argc) {
+			for (int a = 0; a < TUNER_AXIS_COUNT; a++) {
+				if (strcmp(argv[i], axis_flags[a]) == 0) {
+					parsed = tuner_parse_axis(&options.axes[a], argv[++i]);
+					break;
+				}
+			}
+			if (parsed) continue;
+			if (strcmp(argv[i], "--sessions") == 0) {
+				options.sessions = atoi(argv[++i]);
+			} else if (strcmp(argv[i], "--dt") == 0) {
+				options.delta_time = atof(argv[++i]);
+			} else if (strcmp(argv[i], "--max-time") == 0) {
+				options.max_time = atof(argv[++i]);
+			} else if (strcmp(argv[i], "--reaction") == 0) {
+				options.bot.reaction_time = atof(argv[++i]);
+			} else if (strcmp(argv[i], "--mistakes") == 0) {
+				options.bot.mistake_chance = atof(argv[++i]);
+			} else if (strcmp(argv[i], "--seed") == 0) {
+				options.seed = strtoull(argv[++i], NULL, 10);
+			} else if (strcmp(argv[i], "--threads") == 0) {
+				options.threads = atoi(argv[++i]);
+			} else {
+				tuner_print_usage(argv[0]);
+				return 1;
+			}
+			continue;
+		}
+		tuner_print_usage(argv[0]);
+		return 1;
+	}
+	if (options.sessions < 1 || options.delta_time <= 0.0 || options.threads < 1) {
+		tuner_print_usage(argv[0]);
+		return 1;
+	}
+
+	Tuner tuner;
+	tuner.options = &options;
+	tuner.points = 1;
+	for (int i = 0; i < TUNER_AXIS_COUNT; i++) {
+		tuner.points *= options.axes[i].steps;
+	}
+	tuner.chunks_per_point = (options.sessions + TUNER_CHUNK - 1) / TUNER_CHUNK;
+	SDL_AtomicSet(&tuner.chunks_done, 0);
+	tuner.lock = SDL_CreateMutex();
+	tuner.sketches = (Quantile_Sketch*) malloc(sizeof(Quantile_Sketch) * tuner.points);
+	tuner.survived = (uint64_t*) calloc(tuner.points, sizeof(uint64_t));
+	for (int i = 0; i < tuner.points; i++) {
+		sketch_init(&tuner.sketches[i]);
+	}
+
+	uint64_t start = SDL_GetPerformanceCounter();
+	// This thread works through the chunks too
+	Job_System * jobs = jobs_create(options.threads - 1);
+	int total_chunks = tuner.points * tuner.chunks_per_point;
+	Tuner_Chunk * chunks = (Tuner_Chunk*) malloc(sizeof(Tuner_Chunk) * total_chunks);
+	Job_Counter finished;
+	jobs_counter_init(&finished);
+	for (int i = 0; i < total_chunks; i++) {
+		chunks[i] = (Tuner_Chunk) { &tuner, i };
+		jobs_run(jobs, tuner_run_chunk, &chunks[i], JOB_ANY_THREAD, NULL, &finished);
+	}
+	jobs_wait(jobs, &finished);
+	jobs_destroy(jobs);
+	free(chunks);
+	double seconds = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+	fprintf(stderr, "\n%d sessions in %.1f s on %d threads\n",
+			tuner.points * options.sessions, seconds, options.threads);
+
+	for (int i = 0; i < TUNER_AXIS_COUNT; i++) {
+		printf("%s,", tuner_axis_names[i]);
+	}
+	printf("sessions,mean,p10,p50,p90,p99,survived\n");
+	for (int point = 0; point < tuner.points; point++) {
+		Spawn_Params p = tuner_point_params(&options, point);
+		Quantile_Sketch * sketch = &tuner.sketches[point];
+		printf("%g,%g,%g,%g,%g,%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%.3f\n",
+			   p.difficulty, p.sub_base_mult, p.sub_mult_div, p.minimum_spawn_time, p.mst_div,
+			   (unsigned long long) sketch->count, sketch_mean(sketch),
+			   sketch_quantile(sketch, 0.10), sketch_quantile(sketch, 0.50),
+			   sketch_quantile(sketch, 0.90), sketch_quantile(sketch, 0.99),
+			   (double) tuner.survived[point] / sketch->count);
+	}
+	return 0;
+}
+// //
+
+// //
+// Kitchen solver
+// Treats a seeded session as a scheduling problem and searches for the
+// longest possible survival. The spawn schedule and the orders only
+// depend on the seed and the spawn parameters, so they are known up
+// front. Drags are taken to be instant, so play only has to decide, at
+// each cook completion or spawn, what each free fire cooks and which
+// unwanted food gets thrown away. Serving a cooked item to a god whose
+// next order it is never hurts and is always done.
+//
+// The search is a depth-first branch-and-bound. Each node's optimistic
+// bound comes from a relaxation where fires never block and orders can
+// be served in any order. Searched nodes are kept in a transposition
+// table. The tree is split into subtrees near the root, and those are
+// searched on all cores, sharing the best survival found so far.
+#define SOLVER_TICKS_PER_SECOND 100
+#define SOLVER_COOK_TICKS       ((int) (COOK_TIME * SOLVER_TICKS_PER_SECOND))
+#define SOLVER_MAX_SPAWNS       2048
+// Bits of a packed node's tick, which bounds the horizon
+#define SOLVER_TICK_BITS        26
+#define SOLVER_MAX_HORIZON      ((double) ((1 << SOLVER_TICK_BITS) - 1) / SOLVER_TICKS_PER_SECOND)
+#define SOLVER_ORDER_MAX        ORDER_MAX
+#define SOLVER_HORIZON          600.0
+#define SOLVER_NODE_BUDGET      50000000
+#define SOLVER_TT_BITS          20
+#define SOLVER_TT_PROBES        4
+#define SOLVER_SUBTREES_PER_THREAD 8
+
+typedef struct {
+	int spawn_ticks[SOLVER_MAX_SPAWNS];
+	// Raw ingredients, bottom of the stack first
+	int8_t orders[SOLVER_MAX_SPAWNS][SOLVER_ORDER_MAX];
+	int8_t order_counts[SOLVER_MAX_SPAWNS];
+	// Spawns before the horizon
+	int spawn_count;
+	// Pulled in to the first spawn past SOLVER_MAX_SPAWNS
+	int horizon_ticks;
+} Solver_Problem;
+
+typedef struct {
+	int tick;
+	int next_spawn;
+	// Raw ingredient or -1 for an empty fire
+	int8_t fire_item[UI_FIRE_COUNT];
+	bool fire_cooked[UI_FIRE_COUNT];
+	int16_t fire_left[UI_FIRE_COUNT];
+	// Empty tables have a count of 0
+	int8_t table_count[UI_TABLE_COUNT];
+	int8_t table_items[UI_TABLE_COUNT][SOLVER_ORDER_MAX];
+	// Survival in ticks when this node ends the game, otherwise -1
+	int terminal;
+} Solver_Node;
+
+typedef struct {
+	uint64_t key[2];
+	int upper;
+} Solver_Entry;
+
+typedef struct {
+	Solver_Problem * problem;
+	SDL_atomic_t best;
+	SDL_atomic_t next_subtree;
+	SDL_atomic_t nodes;
+	int node_budget;
+	Solver_Node * subtrees;
+	int * subtree_uppers;
+} Solver;
+
+typedef struct {
+	Solver * solver;
+	Solver_Entry * table;
+	// Children of every frame on the search path, back to back
+	Solver_Node * children;
+	int nodes;
+} Solver_Thread;
+
+void solver_build_problem(Solver_Problem * problem, Spawn_Params * params, uint32_t seed, float horizon)
+{
+	Rng order_rng;
+	rng_seed(&order_rng, seed, RNG_STREAM_ORDER);
+	problem->horizon_ticks = (int) (horizon * SOLVER_TICKS_PER_SECOND);
+	problem->spawn_count = 0;
+	Ingredient * order = NULL;
+	float time = 0.0;
+	float reset = SPAWN_FIRST_RESET;
+	for (;;) {
+		int tick = (int) lroundf(time * SOLVER_TICKS_PER_SECOND);
+		if (tick >= problem->horizon_ticks) break;
+		if (problem->spawn_count == SOLVER_MAX_SPAWNS) {
+			// Nothing past here is known to the search
+			problem->horizon_ticks = tick;
+			break;
+		}
+		int k = problem->spawn_count++;
+		problem->spawn_ticks[k] = tick;
+		order = generate_order(&order_rng, order);
+		problem->order_counts[k] = sb_count(order);
+		for (int i = 0; i < sb_count(order); i++) {
+			problem->orders[k][i] = order[i] - INGRED_UNCOOKED_COUNT;
+		}
+		time += reset;
+		reset = spawn_reset_next(params, reset);
+	}
+	sb_free(order);
+}
+
+void solver_atomic_max(SDL_atomic_t * a, int value)
+{
+	int current;
+	do {
+		current = SDL_AtomicGet(a);
+		if (value <= current) return;
+	} while (!SDL_AtomicCAS(a, current, value));
+}
+
+// Packs a node into 128 bits. Fires and tables are sorted first,
+// since which fire or table holds what does not matter.
+void solver_pack(Solver_Node * node, uint64_t key[2])
+{
+	uint64_t fires[UI_FIRE_COUNT];
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		fires[f] = (uint64_t) (node->fire_item[f] & 7) |
+			((uint64_t) node->fire_cooked[f] << 3) |
+			((uint64_t) node->fire_left[f] << 4);
+	}
+	uint64_t tables[UI_TABLE_COUNT];
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		tables[t] = node->table_count[t];
+		for (int i = 0; i < node->table_count[t]; i++) {
+			tables[t] |= (uint64_t) node->table_items[t][i] << (2 + 3 * i);
+		}
+	}
+	// Insertion sorts, the arrays are tiny
+	for (int i = 1; i < UI_FIRE_COUNT; i++) {
+		for (int j = i; j > 0 && fires[j] < fires[j - 1]; j--) {
+			uint64_t tmp = fires[j]; fires[j] = fires[j - 1]; fires[j - 1] = tmp;
+		}
+	}
+	for (int i = 1; i < UI_TABLE_COUNT; i++) {
+		for (int j = i; j > 0 && tables[j] < tables[j - 1]; j--) {
+			uint64_t tmp = tables[j]; tables[j] = tables[j - 1]; tables[j - 1] = tmp;
+		}
+	}
+	// SOLVER_TICK_BITS of tick, 12 of spawn index (up to and including
+	// SOLVER_MAX_SPAWNS), 13 per fire
+	key[0] = (uint64_t) node->tick | ((uint64_t) node->next_spawn << SOLVER_TICK_BITS);
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		key[0] |= fires[f] << (SOLVER_TICK_BITS + 12 + 13 * f);
+	}
+	// 11 bits per table
+	key[1] = 0;
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		key[1] |= tables[t] << (11 * t);
+	}
+}
+
+Solver_Entry * solver_lookup(Solver_Thread * thread, uint64_t key[2], bool * found)
+{
+	uint64_t hash = (key[0] * 0x9e3779b97f4a7c15) ^ (key[1] * 0xc2b2ae3d27d4eb4f);
+	hash ^= hash >> 29;
+	uint64_t mask = (1 << SOLVER_TT_BITS) - 1;
+	Solver_Entry * slot = &thread->table[hash & mask];
+	for (int i = 0; i < SOLVER_TT_PROBES; i++) {
+		Solver_Entry * entry = &thread->table[(hash + i) & mask];
+		if (entry->key[0] == key[0] && entry->key[1] == key[1]) {
+			*found = true;
+			return entry;
+		}
+		if (entry->upper < slot->upper) slot = entry;
+	}
+	// Not found: hand back the least valuable slot to replace
+	*found = false;
+	return slot;
+}
+
+// Optimistic survival: ignores fire blocking and stack order, and
+// lets gods be served before they arrive. Spawn k is lost only if, even
+// then, four gods from before it cannot have been cleared in time.
+int solver_bound(Solver_Problem * problem, Solver_Node * node)
+{
+	int on_fire = 0;
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		if (node->fire_item[f] != -1) on_fire++;
+	}
+	// Gods waiting, bucketed by how many items they still need
+	int waiting[SOLVER_ORDER_MAX + 1] = { 0 };
+	int present = 0;
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		if (node->table_count[t] > 0) {
+			waiting[node->table_count[t]]++;
+			present++;
+		}
+	}
+	for (int k = node->next_spawn; k < problem->spawn_count; k++) {
+		int elapsed = problem->spawn_ticks[k] - node->tick;
+		int capacity = on_fire + UI_FIRE_COUNT * (elapsed / SOLVER_COOK_TICKS);
+		int cleared = 0;
+		for (int size = 1; size <= SOLVER_ORDER_MAX; size++) {
+			int n = SDL_min(waiting[size], capacity / size);
+			cleared += n;
+			capacity -= n * size;
+		}
+		if (present - cleared >= UI_TABLE_COUNT) {
+			return problem->spawn_ticks[k];
+		}
+		waiting[problem->order_counts[k]]++;
+		present++;
+	}
+	return problem->horizon_ticks;
+}
+
+// Moves time to the next cook completion or spawn, and seats the god
+// if it was a spawn. Sets terminal when the game ends there.
+void solver_advance(Solver_Problem * problem, Solver_Node * node)
+{
+	int next = node->next_spawn < problem->spawn_count ?
+		problem->spawn_ticks[node->next_spawn] : problem->horizon_ticks;
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		if (node->fire_item[f] != -1 && !node->fire_cooked[f]) {
+			next = SDL_min(next, node->tick + node->fire_left[f]);
+		}
+	}
+	if (next >= problem->horizon_ticks) {
+		node->terminal = problem->horizon_ticks;
+		return;
+	}
+	int elapsed = next - node->tick;
+	node->tick = next;
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		if (node->fire_item[f] != -1 && !node->fire_cooked[f]) {
+			node->fire_left[f] -= elapsed;
+			if (node->fire_left[f] <= 0) {
+				node->fire_left[f] = 0;
+				node->fire_cooked[f] = true;
+			}
+		}
+	}
+	if (node->next_spawn < problem->spawn_count &&
+		problem->spawn_ticks[node->next_spawn] == node->tick) {
+		int k = node->next_spawn++;
+		for (int t = 0; t < UI_TABLE_COUNT; t++) {
+			if (node->table_count[t] == 0) {
+				node->table_count[t] = problem->order_counts[k];
+				memcpy(node->table_items[t], problem->orders[k], SOLVER_ORDER_MAX);
+				return;
+			}
+		}
+		node->terminal = node->tick;
+	}
+}
+
+void solver_cook(Solver_Node * node, int fire, int item)
+{
+	node->fire_item[fire] = item;
+	node->fire_cooked[fire] = false;
+	node->fire_left[fire] = SOLVER_COOK_TICKS;
+}
+
+// Every raw ingredient, most useful first so good lines are found early
+// and prune the rest: anything on the tables, tops first, then the next
+// god's order, then the ones nobody wants yet
+int solver_candidates(Solver_Problem * problem, Solver_Node * node, int * items)
+{
+	int count = 0;
+	bool seen[INGRED_UNCOOKED_COUNT] = { false };
+	for (int depth = 0; depth < SOLVER_ORDER_MAX; depth++) {
+		for (int t = 0; t < UI_TABLE_COUNT; t++) {
+			int i = node->table_count[t] - 1 - depth;
+			if (i < 0) continue;
+			int item = node->table_items[t][i];
+			if (!seen[item]) {
+				seen[item] = true;
+				items[count++] = item;
+			}
+		}
+	}
+	if (node->next_spawn < problem->spawn_count) {
+		int k = node->next_spawn;
+		for (int i = problem->order_counts[k] - 1; i >= 0; i--) {
+			int item = problem->orders[k][i];
+			if (!seen[item]) {
+				seen[item] = true;
+				items[count++] = item;
+			}
+		}
+	}
+	for (int item = 0; item < INGRED_UNCOOKED_COUNT; item++) {
+		if (!seen[item]) {
+			items[count++] = item;
+		}
+	}
+	return count;
+}
+
+void solver_push_decisions(Solver_Thread * thread, Solver_Node * node);
+
+// Serves every cooked item that is some god's next order, branching
+// when two gods want the same thing
+void solver_push_deliveries(Solver_Thread * thread, Solver_Node * node)
+{
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		if (node->fire_item[f] == -1 || !node->fire_cooked[f]) continue;
+		bool delivered = false;
+		for (int t = 0; t < UI_TABLE_COUNT; t++) {
+			int count = node->table_count[t];
+			if (count == 0 || node->table_items[t][count - 1] != node->fire_item[f]) continue;
+			// Gods with identical stacks are interchangeable
+			bool duplicate = false;
+			for (int u = 0; u < t; u++) {
+				if (node->table_count[u] == count &&
+					memcmp(node->table_items[u], node->table_items[t], count) == 0) {
+					duplicate = true;
+				}
+			}
+			if (duplicate) continue;
+			Solver_Node child = *node;
+			child.table_count[t]--;
+			child.fire_item[f] = -1;
+			child.fire_cooked[f] = false;
+			solver_push_deliveries(thread, &child);
+			delivered = true;
+		}
+		if (delivered) return;
+	}
+	solver_push_decisions(thread, node);
+}
+
+void solver_push_child(Solver_Thread * thread, Solver_Node * child)
+{
+	solver_advance(thread->solver->problem, child);
+	sb_push(thread->children, *child);
+}
+
+// Every combination of throwing out unwanted food and starting to cook
+// on free fires. Throwing food out and then leaving the fire idle is
+// skipped: keeping the food and throwing it out later is never worse.
+void solver_push_decisions(Solver_Thread * thread, Solver_Node * node)
+{
+	Solver_Problem * problem = thread->solver->problem;
+	int items[INGRED_UNCOOKED_COUNT + 1];
+	int item_count = solver_candidates(problem, node, items);
+	// -1 leaves the fire idle
+	items[item_count++] = -1;
+
+	int cooked_mask = 0;
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		if (node->fire_item[f] != -1 && node->fire_cooked[f]) cooked_mask |= 1 << f;
+	}
+	for (int trash = 0; trash < (1 << UI_FIRE_COUNT); trash++) {
+		if ((trash & cooked_mask) != trash) continue;
+		Solver_Node base = *node;
+		int free_fires[UI_FIRE_COUNT];
+		int free_count = 0;
+		for (int f = 0; f < UI_FIRE_COUNT; f++) {
+			if (trash & (1 << f)) {
+				base.fire_item[f] = -1;
+				base.fire_cooked[f] = false;
+			}
+			if (base.fire_item[f] == -1) free_fires[free_count++] = f;
+		}
+		// Choices per free fire, as a non-decreasing sequence of item
+		// indices since the fires are interchangeable
+		int choice[UI_FIRE_COUNT] = { 0 };
+		while (true) {
+			bool valid = true;
+			Solver_Node child = base;
+			for (int i = 0; i < free_count; i++) {
+				int item = items[choice[i]];
+				if (item == -1) {
+					if (trash & (1 << free_fires[i])) valid = false;
+				} else {
+					solver_cook(&child, free_fires[i], item);
+				}
+			}
+			if (valid) {
+				solver_push_child(thread, &child);
+			}
+			// Next combination
+			int i = free_count - 1;
+			while (i >= 0 && choice[i] == item_count - 1) i--;
+			if (i < 0) break;
+			choice[i]++;
+			for (int j = i + 1; j < free_count; j++) choice[j] = choice[i];
+		}
+	}
+}
+
+// Returns an upper bound on the survival reachable from node, exact when
+// nothing below it was cut off
+int solver_search(Solver_Thread * thread, Solver_Node * node)
+{
+	Solver * solver = thread->solver;
+	if (node->terminal != -1) {
+		solver_atomic_max(&solver->best, node->terminal);
+		return node->terminal;
+	}
+	int bound = solver_bound(solver->problem, node);
+	if (bound <= SDL_AtomicGet(&solver->best)) {
+		return bound;
+	}
+	if (++thread->nodes % 4096 == 0) {
+		SDL_AtomicAdd(&solver->nodes, 4096);
+	}
+	if (SDL_AtomicGet(&solver->nodes) >= solver->node_budget) {
+		return bound;
+	}
+	uint64_t key[2];
+	solver_pack(node, key);
+	bool found;
+	Solver_Entry * entry = solver_lookup(thread, key, &found);
+	if (found && entry->upper <= SDL_AtomicGet(&solver->best)) {
+		return entry->upper;
+	}
+
+	int first = sb_count(thread->children);
+	solver_push_deliveries(thread, node);
+	int last = sb_count(thread->children);
+	int upper = -1;
+	for (int i = first; i < last; i++) {
+		// Copied out since deeper frames may grow the buffer
+		Solver_Node child = thread->children[i];
+		upper = SDL_max(upper, solver_search(thread, &child));
+		if (upper >= bound) break;
+	}
+	if (thread->children) stb__sbn(thread->children) = first;
+	upper = SDL_min(upper, bound);
+
+	entry = solver_lookup(thread, key, &found);
+	entry->key[0] = key[0];
+	entry->key[1] = key[1];
+	entry->upper = upper;
+	return upper;
+}
+
+// One job per thread, each with its own transposition table, taking
+// subtrees until there are none left
+void solver_worker(void * data)
+{
+	Solver * solver = (Solver*) data;
+	Solver_Thread thread;
+	thread.solver = solver;
+	thread.table = (Solver_Entry*) calloc(1 << SOLVER_TT_BITS, sizeof(Solver_Entry));
+	thread.children = NULL;
+	thread.nodes = 0;
+	while (true) {
+		int i = SDL_AtomicAdd(&solver->next_subtree, 1);
+		if (i >= sb_count(solver->subtrees)) break;
+		solver->subtree_uppers[i] = solver_search(&thread, &solver->subtrees[i]);
+	}
+	sb_free(thread.children);
+	free(thread.table);
+}
+
+// Expands the root breadth-first until there is enough to share out
+void solver_split(Solver * solver, Solver_Node * root, int wanted)
+{
+	Solver_Thread thread;
+	thread.solver = solver;
+	thread.children = NULL;
+	sb_push(solver->subtrees, *root);
+	while (sb_count(solver->subtrees) < wanted) {
+		Solver_Node * next = NULL;
+		bool expanded = false;
+		for (int i = 0; i < sb_count(solver->subtrees); i++) {
+			Solver_Node node = solver->subtrees[i];
+			if (node.terminal != -1) {
+				sb_push(next, node);
+				continue;
+			}
+			if (thread.children) stb__sbn(thread.children) = 0;
+			solver_push_deliveries(&thread, &node);
+			for (int c = 0; c < sb_count(thread.children); c++) {
+				sb_push(next, thread.children[c]);
+			}
+			expanded = true;
+		}
+		sb_free(solver->subtrees);
+		solver->subtrees = next;
+		if (!expanded) break;
+	}
+	sb_free(thread.children);
+}
+
+void solver_print_usage(char * program)
+{
+	fprintf(stderr,
+			"Usage: %s --solve [options]\n"
+			"  --seed <n>            session seed\n"
+			"  --difficulty <d>      difficulty, 1 to %d\n"
+			"  --horizon <seconds>   stop searching past this survival (%.0f, at most %.0f)\n"
+			"  --nodes <n>           search budget (%d)\n"
+			"  --threads <n>         worker threads (all cores)\n",
+			program, DIFFICULTY_MULT, SOLVER_HORIZON, SOLVER_MAX_HORIZON, SOLVER_NODE_BUDGET);
+}
+
+int solver_main(int argc, char ** argv)
+{
+	uint32_t seed = 1;
+	Spawn_Params params = default_spawn_params(1.5);
+	float horizon = SOLVER_HORIZON;
+	int node_budget = SOLVER_NODE_BUDGET;
+	int threads = SDL_GetCPUCount();
+	for (int i = 2; i < argc; i++) {
+		if (i + 1 >= argc) {
+			solver_print_usage(argv[0]);
+			return 1;
+		}
+		if (strcmp(argv[i], "--seed") == 0) {
+			seed = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--difficulty") == 0) {
+			params.difficulty = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--horizon") == 0) {
+			horizon = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--nodes") == 0) {
+			node_budget = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--threads") == 0) {
+			threads = atoi(argv[++i]);
+		} else {
+			solver_print_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (threads < 1) threads = 1;
+	if (!(horizon > 0.0 && horizon <= SOLVER_MAX_HORIZON)) {
+		solver_print_usage(argv[0]);
+		return 1;
+	}
+
+	Solver_Problem * problem = (Solver_Problem*) malloc(sizeof(Solver_Problem));
+	solver_build_problem(problem, &params, seed, horizon);
+
+	Solver solver;
+	solver.problem = problem;
+	SDL_AtomicSet(&solver.best, 0);
+	SDL_AtomicSet(&solver.next_subtree, 0);
+	SDL_AtomicSet(&solver.nodes, 0);
+	solver.node_budget = node_budget;
+	solver.subtrees = NULL;
+
+	// The first god sits down at tick 0
+	Solver_Node root;
+	memset(&root, 0, sizeof(root));
+	root.terminal = -1;
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		root.fire_item[f] = -1;
+	}
+	solver_advance(problem, &root);
+
+	uint64_t start = SDL_GetPerformanceCounter();
+	solver_split(&solver, &root, threads * SOLVER_SUBTREES_PER_THREAD);
+	solver.subtree_uppers = (int*) malloc(sizeof(int) * sb_count(solver.subtrees));
+	// The calling thread is one of them
+	Job_System * jobs = jobs_create(threads - 1);
+	Job_Counter finished;
+	jobs_counter_init(&finished);
+	for (int i = 0; i < threads; i++) {
+		jobs_run(jobs, solver_worker, &solver, JOB_ANY_THREAD, NULL, &finished);
+	}
+	jobs_wait(jobs, &finished);
+	jobs_destroy(jobs);
+	double seconds = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+	int upper = 0;
+	for (int i = 0; i < sb_count(solver.subtrees); i++) {
+		upper = SDL_max(upper, solver.subtree_uppers[i]);
+	}
+	int best = SDL_AtomicGet(&solver.best);
+	printf("seed %u, difficulty %.2f, %d spawns before %.0f s\n",
+		   seed, params.difficulty, problem->spawn_count,
+		   (float) problem->horizon_ticks / SOLVER_TICKS_PER_SECOND);
+	printf("best survival found: %.2f s\n", (float) best / SOLVER_TICKS_PER_SECOND);
+	printf("upper bound:         %.2f s%s\n", (float) upper / SOLVER_TICKS_PER_SECOND,
+		   upper == best ? " (exact)" : "");
+	if (best >= problem->horizon_ticks) {
+		printf("survivable to the horizon\n");
+	}
+	printf("%d+ nodes in %.1f s on %d threads\n", SDL_AtomicGet(&solver.nodes), seconds, threads);
+	return 0;
+}
+// //
+
+// //
+// Batched environments (see env.h)
+// Same rules as State_Playing, with the state of all environments laid
+// out as arrays per field. Indices run environment-fastest, so the timer
+// updates are flat loops the compiler can vectorize.
+#define ENV_SERVE_REWARD   1.0
+#define ENV_CLEAR_REWARD   2.0
+#define ENV_LOSS_REWARD  -10.0
+
+struct Env_Batch {
+	int count;
+	float delta_time;
+	Spawn_Params params;
+	uint32_t seed;
+	// [e]
+	uint32_t * episode;
+	float * time_spent;
+	float * spawn_timer;
+	float * spawn_reset;
+	int8_t * held;
+	int8_t * held_from;
+	uint8_t * god_pool_count;
+	Rng * order_rng;
+	Rng * god_rng;
+	// [f * count + e]
+	int8_t * fire_item;
+	float * fire_cooking;
+	float * cook_time;
+	// [t * count + e]
+	int8_t * table_god;
+	uint8_t * order_count;
+	// [(t * ORDER_MAX + i) * count + e]
+	int8_t * orders;
+	// [g * count + e]
+	int8_t * god_pool;
+};
+
+#define ENV_AT(batch, array, row, e) ((batch)->array[(row) * (batch)->count + (e)])
+
+Env_Batch * env_batch_create(int count, float difficulty, float delta_time, uint32_t seed)
 {
-	Ingredient * list = NULL;
-	int amt = (rand() % 3) + 1;
-	for (int i = 0; i < amt; i++) {
-		sb_push(list, (rand() % INGRED_UNCOOKED_COUNT) + INGRED_UNCOOKED_COUNT);
+	Env_Batch * batch = (Env_Batch*) calloc(1, sizeof(Env_Batch));
+	batch->count = count;
+	batch->delta_time = delta_time;
+	batch->params = default_spawn_params(difficulty);
+	batch->seed = seed;
+	batch->episode = (uint32_t*) calloc(count, sizeof(uint32_t));
+	batch->time_spent = (float*) calloc(count, sizeof(float));
+	batch->spawn_timer = (float*) calloc(count, sizeof(float));
+	batch->spawn_reset = (float*) calloc(count, sizeof(float));
+	batch->held = (int8_t*) calloc(count, sizeof(int8_t));
+	batch->held_from = (int8_t*) calloc(count, sizeof(int8_t));
+	batch->god_pool_count = (uint8_t*) calloc(count, sizeof(uint8_t));
+	batch->order_rng = (Rng*) calloc(count, sizeof(Rng));
+	batch->god_rng = (Rng*) calloc(count, sizeof(Rng));
+	batch->fire_item = (int8_t*) calloc(count * UI_FIRE_COUNT, sizeof(int8_t));
+	batch->fire_cooking = (float*) calloc(count * UI_FIRE_COUNT, sizeof(float));
+	batch->cook_time = (float*) calloc(count * UI_FIRE_COUNT, sizeof(float));
+	batch->table_god = (int8_t*) calloc(count * UI_TABLE_COUNT, sizeof(int8_t));
+	batch->order_count = (uint8_t*) calloc(count * UI_TABLE_COUNT, sizeof(uint8_t));
+	batch->orders = (int8_t*) calloc(count * UI_TABLE_COUNT * ORDER_MAX, sizeof(int8_t));
+	batch->god_pool = (int8_t*) calloc(count * GOD_COUNT, sizeof(int8_t));
+	for (int e = 0; e < count; e++) {
+		env_batch_reset(batch, e, seed + e);
 	}
-	return list;
+	return batch;
 }
 
-Playing_Msg state_playing_update(State_Playing * state)
+void env_batch_destroy(Env_Batch * batch)
 {
-	// Death screen
-	if (state->lost) {
-		if (state->death_timer < 0) {
-			return PLAYING_LOST;
+	free(batch->episode);
+	free(batch->time_spent);
+	free(batch->spawn_timer);
+	free(batch->spawn_reset);
+	free(batch->held);
+	free(batch->held_from);
+	free(batch->god_pool_count);
+	free(batch->order_rng);
+	free(batch->god_rng);
+	free(batch->fire_item);
+	free(batch->fire_cooking);
+	free(batch->cook_time);
+	free(batch->table_god);
+	free(batch->order_count);
+	free(batch->orders);
+	free(batch->god_pool);
+	free(batch);
+}
+
+void env_batch_reset(Env_Batch * batch, int e, uint32_t seed)
+{
+	rng_seed(&batch->order_rng[e], seed, RNG_STREAM_ORDER);
+	rng_seed(&batch->god_rng[e], seed, RNG_STREAM_GOD);
+	batch->time_spent[e] = 0.0;
+	batch->spawn_timer[e] = 0.0;
+	batch->spawn_reset[e] = SPAWN_FIRST_RESET;
+	batch->held[e] = INGRED_NONE;
+	batch->held_from[e] = -1;
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		ENV_AT(batch, fire_item, f, e) = INGRED_NONE;
+		ENV_AT(batch, fire_cooking, f, e) = 0.0;
+		ENV_AT(batch, cook_time, f, e) = COOK_TIME;
+	}
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		ENV_AT(batch, table_god, t, e) = GOD_NONE;
+		ENV_AT(batch, order_count, t, e) = 0;
+	}
+	for (int g = 0; g < GOD_COUNT; g++) {
+		ENV_AT(batch, god_pool, g, e) = g;
+	}
+	batch->god_pool_count[e] = GOD_COUNT;
+}
+
+// Puts whatever is held back where it came from, like a release
+// over nothing
+void env_release(Env_Batch * batch, int e)
+{
+	if (batch->held_from[e] != -1) {
+		ENV_AT(batch, fire_item, batch->held_from[e], e) = batch->held[e];
+	}
+	batch->held[e] = INGRED_NONE;
+	batch->held_from[e] = -1;
+}
+
+// Mirrors state_playing_mbdown/state_playing_mbup
+float env_apply_action(Env_Batch * batch, int e, int action)
+{
+	float reward = 0.0;
+	if (action >= ENV_ACTION_PICK_GENERATOR && action < ENV_ACTION_PICK_FIRE) {
+		env_release(batch, e);
+		batch->held[e] = action - ENV_ACTION_PICK_GENERATOR;
+	} else if (action >= ENV_ACTION_PICK_FIRE && action < ENV_ACTION_DROP_FIRE) {
+		env_release(batch, e);
+		int f = action - ENV_ACTION_PICK_FIRE;
+		int8_t * item = &ENV_AT(batch, fire_item, f, e);
+		if (*item != INGRED_NONE && ENV_AT(batch, fire_cooking, f, e) == 0.0) {
+			batch->held[e] = *item;
+			batch->held_from[e] = f;
+			*item = INGRED_NONE;
+		}
+	} else if (batch->held[e] == INGRED_NONE) {
+		return 0.0;
+	} else if (action >= ENV_ACTION_DROP_FIRE && action < ENV_ACTION_DROP_TABLE) {
+		int f = action - ENV_ACTION_DROP_FIRE;
+		if (ENV_AT(batch, fire_item, f, e) == INGRED_NONE && batch->held[e] < INGRED_UNCOOKED_COUNT) {
+			ENV_AT(batch, fire_item, f, e) = batch->held[e];
+			ENV_AT(batch, fire_cooking, f, e) = 1.0;
+			ENV_AT(batch, cook_time, f, e) = COOK_TIME;
+			batch->held[e] = INGRED_NONE;
+			batch->held_from[e] = -1;
+		}
+		env_release(batch, e);
+	} else if (action >= ENV_ACTION_DROP_TABLE && action < ENV_ACTION_DROP_TRASH) {
+		int t = action - ENV_ACTION_DROP_TABLE;
+		uint8_t * count = &ENV_AT(batch, order_count, t, e);
+		if (ENV_AT(batch, table_god, t, e) != GOD_NONE &&
+			ENV_AT(batch, orders, t * ORDER_MAX + *count - 1, e) == batch->held[e]) {
+			reward += ENV_SERVE_REWARD;
+			batch->held[e] = INGRED_NONE;
+			batch->held_from[e] = -1;
+			if (--*count == 0) {
+				reward += ENV_CLEAR_REWARD;
+				ENV_AT(batch, god_pool, batch->god_pool_count[e]++, e) = ENV_AT(batch, table_god, t, e);
+				ENV_AT(batch, table_god, t, e) = GOD_NONE;
+			}
+		}
+		env_release(batch, e);
+	} else if (action == ENV_ACTION_DROP_TRASH) {
+		batch->held[e] = INGRED_NONE;
+		batch->held_from[e] = -1;
+	}
+	return reward;
+}
+
+// Seats a god like state_playing_update does. Returns false when every
+// table is taken.
+bool env_spawn(Env_Batch * batch, int e)
+{
+	batch->spawn_timer[e] = batch->spawn_reset[e];
+	batch->spawn_reset[e] = spawn_reset_next(&batch->params, batch->spawn_reset[e]);
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		if (ENV_AT(batch, table_god, t, e) != GOD_NONE) continue;
+		int i = rng_range(&batch->god_rng[e], batch->god_pool_count[e]);
+		int last = --batch->god_pool_count[e];
+		ENV_AT(batch, table_god, t, e) = ENV_AT(batch, god_pool, i, e);
+		ENV_AT(batch, god_pool, i, e) = ENV_AT(batch, god_pool, last, e);
+		Ingredient items[ORDER_MAX];
+		int count = generate_order_items(&batch->order_rng[e], items);
+		ENV_AT(batch, order_count, t, e) = count;
+		for (int o = 0; o < count; o++) {
+			ENV_AT(batch, orders, t * ORDER_MAX + o, e) = items[o];
 		}
-		state->death_timer -= sdl_state.delta_time;
-		return PLAYING_OK;
+		return true;
+	}
+	return false;
+}
+
+void env_batch_step(Env_Batch * batch, const int32_t * actions,
+					float * rewards, uint8_t * dones, float * observations)
+{
+	int count = batch->count;
+	float dt = batch->delta_time;
+	for (int e = 0; e < count; e++) {
+		float reward = actions ? env_apply_action(batch, e, actions[e]) : 0.0;
+		if (rewards) rewards[e] = reward;
+		if (dones) dones[e] = 0;
 	}
 
 	// Cook food
-	for (int i = 0; i < UI_FIRE_COUNT; i++) {
-		Fire * fire = &state->fires[i];
-		if (fire->cooking) {
-			fire->cook_time -= sdl_state.delta_time;
-			if (fire->cook_time <= 0) {
-				play_sound(SOUND_TSS);
-				fire->cooking = false;
-				fire->in_fire += INGRED_UNCOOKED_COUNT;
-			}
+	for (int i = 0; i < count * UI_FIRE_COUNT; i++) {
+		batch->cook_time[i] -= dt * batch->fire_cooking[i];
+	}
+	for (int i = 0; i < count * UI_FIRE_COUNT; i++) {
+		if (batch->fire_cooking[i] != 0.0 && batch->cook_time[i] <= 0.0) {
+			batch->fire_cooking[i] = 0.0;
+			batch->fire_item[i] += INGRED_UNCOOKED_COUNT;
 		}
 	}
+
 	// Spawn gods
-	if (state->god_spawn_timer <= 0.0) {
-		state->god_spawn_timer = state->god_spawn_reset;
-		state->god_spawn_this_reset = state->god_spawn_reset;
-		state->god_spawn_reset *= SUB_BASE_MULT - (difficulty / SUB_MULT_DIV);
-		state->god_spawn_reset = fmax(state->god_spawn_reset, MINIMUM_SPAWN_TIME - (difficulty / MST_DIV));
-		bool full = true;
-		for (int i = 0; i < UI_TABLE_COUNT; i++) {
-			if (state->tables[i] == GOD_NONE) {
-				God g;
-				while (true) {
-					g = rand() % GOD_COUNT;
-					bool repeat = false;
-					for (int i = 0; i < UI_TABLE_COUNT; i++) {
-						if (state->tables[i] == g) repeat = true;
-					}
-					if (!repeat) break;
-				}
-				play_sound(SOUND_TABLED);
-				state->tables[i] = g;
-				state->table_orders[i] = generate_order();
-				full = false;
-				break;
+	for (int e = 0; e < count; e++) {
+		if (batch->spawn_timer[e] > 0.0) continue;
+		if (!env_spawn(batch, e)) {
+			if (rewards) rewards[e] += ENV_LOSS_REWARD;
+			if (dones) dones[e] = 1;
+			batch->episode[e]++;
+			env_batch_reset(batch, e, batch->seed + e + batch->episode[e] * (uint32_t) count);
+		}
+	}
+	for (int e = 0; e < count; e++) {
+		batch->spawn_timer[e] -= dt;
+		batch->time_spent[e] += dt;
+	}
+
+	if (observations) {
+		env_batch_observe(batch, observations);
+	}
+}
+
+void env_batch_observe(Env_Batch * batch, float * observations)
+{
+	for (int e = 0; e < batch->count; e++) {
+		float * obs = observations + e * ENV_OBS_SIZE;
+		for (int f = 0; f < UI_FIRE_COUNT; f++) {
+			*obs++ = ENV_AT(batch, fire_item, f, e);
+			*obs++ = ENV_AT(batch, fire_cooking, f, e);
+			*obs++ = ENV_AT(batch, fire_cooking, f, e) != 0.0 ? ENV_AT(batch, cook_time, f, e) : 0.0;
+		}
+		*obs++ = batch->held[e];
+		for (int t = 0; t < UI_TABLE_COUNT; t++) {
+			int orders = ENV_AT(batch, order_count, t, e);
+			*obs++ = ENV_AT(batch, table_god, t, e);
+			*obs++ = orders;
+			for (int i = 0; i < ORDER_MAX; i++) {
+				*obs++ = i < orders ? ENV_AT(batch, orders, t * ORDER_MAX + i, e) : -1.0;
 			}
 		}
-		if (full) {
-			state->lost = true;
-			play_sound(SOUND_THUNDER);
-			Mix_HaltMusic();
+		*obs++ = batch->spawn_timer[e];
+		*obs++ = batch->spawn_reset[e];
+	}
+}
+
+// Throughput check with random actions
+int env_bench(int count, int steps)
+{
+	Env_Batch * batch = env_batch_create(count, 1.5, 1.0 / 60.0, 1);
+	int32_t * actions = (int32_t*) malloc(sizeof(int32_t) * count);
+	float * rewards = (float*) malloc(sizeof(float) * count);
+	uint8_t * dones = (uint8_t*) malloc(count);
+	float * observations = (float*) malloc(sizeof(float) * count * ENV_OBS_SIZE);
+	Rng rng;
+	rng_seed(&rng, 1, 0);
+	uint64_t episodes = 0;
+	uint64_t start = SDL_GetPerformanceCounter();
+	for (int s = 0; s < steps; s++) {
+		for (int e = 0; e < count; e++) {
+			actions[e] = rng_range(&rng, ENV_ACTION_COUNT);
+		}
+		env_batch_step(batch, actions, rewards, dones, observations);
+		for (int e = 0; e < count; e++) {
+			episodes += dones[e];
 		}
 	}
-	state->god_spawn_timer -= sdl_state.delta_time;
+	double seconds = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+	printf("%d envs x %d steps in %.2f s: %.1f M steps/s, %llu episodes finished\n",
+		   count, steps, seconds, (double) count * steps / seconds / 1e6, (unsigned long long) episodes);
+	free(observations);
+	free(dones);
+	free(rewards);
+	free(actions);
+	env_batch_destroy(batch);
+	return 0;
+}
+// //
 
-	state->time_spent += sdl_state.delta_time;
+// //
+// Environment server (see env_shm.h)
+// Steps full State_Playings for clients in other processes. Actions go
+// through state_playing_event as the clicks a player would make, and
+// responses are written straight into the shared ring. Environments are
+// split evenly over the worker threads, each of which polls its own
+// slots and only sleeps after a stretch of idle passes.
+#ifndef _WIN32
+#define ENV_SERVER_ENVS         64
+#define ENV_SERVER_DIFFICULTY  1.5
+#define ENV_SERVER_DELTA_TIME  (1.0 / 60.0)
+#define ENV_SERVER_IDLE_PASSES 4096
 
-	return PLAYING_OK;
+typedef struct {
+	State_Playing state;
+	uint32_t seed;
+	uint32_t episode;
+} Env_Server_Env;
+
+typedef struct {
+	Engine engine;
+	Env_Shm_Header * header;
+	Env_Server_Env * envs;
+	int first;
+	int last;
+	float delta_time;
+} Env_Server_Worker;
+
+static volatile sig_atomic_t env_server_interrupted = 0;
+
+void env_server_interrupt(int sig)
+{
+	env_server_interrupted = 1;
 }
 
-void state_playing_render(State_Playing * state)
+void env_server_click(Engine * engine, State_Playing * state, Uint32 type, Vector2 pos)
 {
-	// Death screen
-	if (state->lost) {
-		SDL_RenderCopy(sdl_state.renderer, state->death_texture, NULL, NULL);
-		char buffer[512];
-		sprintf(buffer, "You lasted %.0f seconds", state->time_spent);
-		int w, h;
-		SDL_Texture * texture = render_text(buffer, (SDL_Color) { 0xff, 0xff, 0xff, 0xff }, &w, &h);
-		SDL_Rect rect = (SDL_Rect) { DEATH_TEXT_X, DEATH_TEXT_Y, w, h };
-		SDL_RenderCopy(sdl_state.renderer, texture, NULL, &rect);
-		SDL_DestroyTexture(texture);
+	SDL_Event event;
+	memset(&event, 0, sizeof(event));
+	event.type = type;
+	event.button.x = pos.x;
+	event.button.y = pos.y;
+	state_playing_event(engine, state, event);
+}
+
+// Picks let go of anything held first, over empty floor, so it goes back
+// where it came from like in Env_Batch
+void env_server_action(Engine * engine, State_Playing * state, int action)
+{
+	SDL_Rect box;
+	bool pick = true;
+	if (action >= ENV_ACTION_PICK_GENERATOR && action < ENV_ACTION_PICK_FIRE) {
+		box = ingredient_box(action - ENV_ACTION_PICK_GENERATOR);
+	} else if (action >= ENV_ACTION_PICK_FIRE && action < ENV_ACTION_DROP_FIRE) {
+		box = fire_box(action - ENV_ACTION_PICK_FIRE);
+	} else if (action >= ENV_ACTION_DROP_FIRE && action < ENV_ACTION_DROP_TABLE) {
+		box = fire_box(action - ENV_ACTION_DROP_FIRE);
+		pick = false;
+	} else if (action >= ENV_ACTION_DROP_TABLE && action < ENV_ACTION_DROP_TRASH) {
+		box = table_box(action - ENV_ACTION_DROP_TABLE);
+		pick = false;
+	} else if (action == ENV_ACTION_DROP_TRASH) {
+		box = trash_box();
+		pick = false;
+	} else {
 		return;
 	}
+	if (pick) {
+		env_server_click(engine, state, SDL_MOUSEBUTTONUP, make_Vector2(0, 0));
+		env_server_click(engine, state, SDL_MOUSEBUTTONDOWN, rect_center(box));
+	} else {
+		env_server_click(engine, state, SDL_MOUSEBUTTONUP, rect_center(box));
+	}
+}
 
-	// Background
-	SDL_RenderCopy(sdl_state.renderer, state->bg_texture, NULL, NULL);
-	
-	// Generators
-	for (int i = 0; i < INGRED_UNCOOKED_COUNT; i++) {
-		SDL_Rect rect = ingredient_box(i);
-		SDL_RenderCopy(sdl_state.renderer,
-					   state->ingredient_textures[i],
-					   NULL, &rect);
+// Same layout as env_batch_observe
+void env_server_observe(State_Playing * state, float * obs)
+{
+	for (int f = 0; f < UI_FIRE_COUNT; f++) {
+		Fire * fire = &state->fires[f];
+		*obs++ = fire->in_fire;
+		*obs++ = fire->cooking;
+		*obs++ = fire->cooking ? playing_timer_left(state, fire->cook_timer) : 0.0;
 	}
-	
-	// Fire
-	for (int i = 0; i < UI_FIRE_COUNT; i++) {
-		Fire * fire = &state->fires[i];
-		SDL_Rect rect = fire_box(i);
-		SDL_RenderCopy(sdl_state.renderer, state->logs_texture, NULL, &rect);
-		SDL_RenderCopy(sdl_state.renderer, state->fire_textures[fire->frame], NULL, &rect);
-		if (fire->in_fire != INGRED_NONE) {
-			SDL_Rect ingred_rect = fire_shelf_box(i);
-			SDL_RenderCopy(sdl_state.renderer, state->ingredient_textures[fire->in_fire], NULL, &ingred_rect);
-		}
-		
-		// Update fire animation
-		fire->frame_timer -= sdl_state.delta_time * (((float) rand() / (float) RAND_MAX) * 1.2 - 0.1);
-		if (fire->frame_timer < 0) {
-			fire->frame = (fire->frame + 1) % UI_FIRE_FRAMES;
-			fire->frame_timer = UI_FIRE_FPS;
+	*obs++ = state->transient_ingredient;
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		int orders = state->tables[t] != GOD_NONE ? sb_count(state->table_orders[t]) : 0;
+		*obs++ = state->tables[t];
+		*obs++ = orders;
+		for (int i = 0; i < ORDER_MAX; i++) {
+			*obs++ = i < orders ? state->table_orders[t][i] : -1.0;
 		}
 	}
+	*obs++ = playing_timer_left(state, state->spawn_timer);
+	*obs++ = state->god_spawn_reset;
+}
 
-	// Gods
-	for (int i = 0; i < UI_TABLE_COUNT; i++) {
-		God seated = state->tables[i];
-		SDL_Rect rect = table_box(i);
-		if (seated != GOD_NONE) {
-			SDL_RenderCopy(sdl_state.renderer,
-						   state->god_textures[seated],
-						   NULL, &rect);
-		}
+void env_server_reset(Engine * engine, Env_Server_Env * env, uint32_t seed)
+{
+	state_playing_reset(engine, &env->state, seed);
+}
+
+// Rewards match Env_Batch: items served and tables cleared by the
+// action, and a penalty when the session is lost. Lost sessions restart
+// on their own with the next seed.
+void env_server_step(Env_Server_Worker * worker, int e,
+					 Env_Shm_Request * request, Env_Shm_Response * response)
+{
+	Engine * engine = &worker->engine;
+	Env_Server_Env * env = &worker->envs[e];
+	State_Playing * state = &env->state;
+	response->reward = 0.0;
+	response->done = 0;
+	if (request->action == ENV_SHM_RESET) {
+		env->seed = request->seed;
+		env->episode = 0;
+		env_server_reset(engine, env, env->seed);
+		env_server_observe(state, response->observation);
+		return;
 	}
 
-	// Orders
+	int items_before = 0, gods_before = 0;
+	int items_after = 0, gods_after = 0;
 	for (int t = 0; t < UI_TABLE_COUNT; t++) {
 		if (state->tables[t] == GOD_NONE) continue;
-		for (int i = 0; i < sb_count(state->table_orders[t]); i++) {
-			SDL_Rect rect = order_box(t, i);
-			SDL_RenderCopy(sdl_state.renderer,
-						   state->ingredient_textures[state->table_orders[t][i]],
-						   NULL, &rect);
-		}
+		items_before += sb_count(state->table_orders[t]);
+		gods_before++;
+	}
+	env_server_action(engine, state, request->action);
+	for (int t = 0; t < UI_TABLE_COUNT; t++) {
+		if (state->tables[t] == GOD_NONE) continue;
+		items_after += sb_count(state->table_orders[t]);
+		gods_after++;
 	}
+	response->reward += (items_before - items_after) * ENV_SERVE_REWARD;
+	response->reward += (gods_before - gods_after) * ENV_CLEAR_REWARD;
 
-	// Clock
-	{
-		SDL_SetRenderDrawColor(sdl_state.renderer, 0xff, 0xff, 0xff, 0xff);
-		int ox = UI_CLOCK_X, oy = UI_CLOCK_Y;
-		float theta = (2.0 * PI) - (state->god_spawn_timer / state->god_spawn_this_reset) * 2.0 * PI;
-		theta -= (PI / 2.0);
-		int rx = ox + (UI_CLOCK_RADIUS * cos(theta));
-		int ry = oy + (UI_CLOCK_RADIUS * sin(theta));
-		SDL_RenderDrawLine(sdl_state.renderer, ox, oy, rx, ry);
+	state_playing_update(engine, state, worker->delta_time);
+	if (state->lost) {
+		response->reward += ENV_LOSS_REWARD;
+		response->done = 1;
+		env->episode++;
+		env_server_reset(engine, env, env->seed + env->episode * worker->header->env_count);
 	}
-	
-	// Transient ingredient
-	if (state->transient_ingredient != INGRED_NONE) {
-		int mx, my;
-		SDL_GetMouseState(&mx, &my);
-		SDL_Rect rect = make_SDL_Rect(mx - UI_INGRED_SIZE / 2, my - UI_INGRED_SIZE / 2,
-									  UI_INGRED_SIZE, UI_INGRED_SIZE);
-		SDL_RenderCopy(sdl_state.renderer,
-					   state->ingredient_textures[state->transient_ingredient],
-					   NULL, &rect);
+	env_server_observe(state, response->observation);
+}
+
+// One job per worker, polling its slots until shutdown. There are as
+// many threads as jobs, so every one of them keeps running.
+void env_server_worker(void * data)
+{
+	Env_Server_Worker * worker = (Env_Server_Worker*) data;
+	Env_Shm_Header * header = worker->header;
+	int idle = 0;
+	while (!env_server_interrupted && !env_shm_load(&header->shutdown)) {
+		bool busy = false;
+		for (int e = worker->first; e < worker->last; e++) {
+			Env_Shm_Slot * slot = env_shm_slot(header, e);
+			Env_Shm_Request * request;
+			Env_Shm_Response * response;
+			// Only take a request once there is room for its response
+			while ((response = env_shm_response_reserve(slot)) &&
+				   (request = env_shm_request_peek(slot))) {
+				env_server_step(worker, e, request, response);
+				env_shm_request_release(slot);
+				env_shm_response_commit(slot);
+				busy = true;
+			}
+		}
+		if (busy) {
+			idle = 0;
+		} else if (++idle > ENV_SERVER_IDLE_PASSES) {
+			SDL_Delay(1);
+		}
 	}
 }
 
-enum Game_State {
-	STATE_PLAYING,
-	STATE_MAIN_MENU,
-};
+void env_server_print_usage(char * program)
+{
+	fprintf(stderr,
+			"Usage: %s --env-server <name> [options]\n"
+			"Serves environments in the shared memory object /<name>, see env_shm.h\n"
+			"  --envs <n>            environment slots (%d)\n"
+			"  --difficulty <d>      difficulty of every environment (%.2f)\n"
+			"  --dt <seconds>        simulation step per action (%.4f)\n"
+			"  --threads <n>         worker threads (all cores)\n"
+			"  --fixed               play on integer time\n",
+			program, ENV_SERVER_ENVS, ENV_SERVER_DIFFICULTY, ENV_SERVER_DELTA_TIME);
+}
 
-typedef struct {
-	enum Game_State type;
-	union {
-		State_Playing   state_playing;
-		State_Main_Menu state_main_menu;
+int env_server_main(int argc, char ** argv)
+{
+	int env_count = ENV_SERVER_ENVS;
+	float delta_time = ENV_SERVER_DELTA_TIME;
+	int thread_count = SDL_GetCPUCount();
+	Engine engine;
+	engine_init(&engine);
+	engine.difficulty = ENV_SERVER_DIFFICULTY;
+	if (argc < 3 || argv[2][0] == '-') {
+		env_server_print_usage(argv[0]);
+		return 1;
+	}
+	char shm_name[256];
+	snprintf(shm_name, sizeof(shm_name), "/%s", argv[2]);
+	for (int i = 3; i < argc; i++) {
+		if (strcmp(argv[i], "--fixed") == 0) {
+			engine.fixed_point = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			env_server_print_usage(argv[0]);
+			return 1;
+		}
+		if (strcmp(argv[i], "--envs") == 0) {
+			env_count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--difficulty") == 0) {
+			engine.difficulty = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--dt") == 0) {
+			delta_time = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--threads") == 0) {
+			thread_count = atoi(argv[++i]);
+		} else {
+			env_server_print_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (env_count < 1 || delta_time <= 0.0 || thread_count < 1) {
+		env_server_print_usage(argv[0]);
+		return 1;
+	}
+	thread_count = SDL_min(thread_count, env_count);
+
+	size_t size = sizeof(Env_Shm_Header) + sizeof(Env_Shm_Slot) * env_count;
+	int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+		fprintf(stderr, "Couldn't open shared memory %s\n", shm_name);
+		return 1;
+	}
+	if (ftruncate(fd, size) != 0) {
+		fprintf(stderr, "Couldn't size shared memory %s\n", shm_name);
+		close(fd);
+		shm_unlink(shm_name);
+		return 1;
+	}
+	Env_Shm_Header * header = (Env_Shm_Header*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		fprintf(stderr, "Couldn't map shared memory %s\n", shm_name);
+		shm_unlink(shm_name);
+		return 1;
+	}
+	// ftruncate zeroed the slots, so every ring starts out empty
+	header->magic = ENV_SHM_MAGIC;
+	header->version = ENV_SHM_VERSION;
+	header->env_count = env_count;
+	header->shutdown = 0;
+
+	Env_Server_Env * envs = (Env_Server_Env*) calloc(env_count, sizeof(Env_Server_Env));
+	for (int e = 0; e < env_count; e++) {
+		envs[e].seed = e;
+		env_server_reset(&engine, &envs[e], envs[e].seed);
+	}
+	signal(SIGINT, env_server_interrupt);
+	signal(SIGTERM, env_server_interrupt);
+
+	Env_Server_Worker * workers = (Env_Server_Worker*) malloc(sizeof(Env_Server_Worker) * thread_count);
+	for (int i = 0; i < thread_count; i++) {
+		workers[i] = (Env_Server_Worker) {
+			engine, header, envs, env_count * i / thread_count, env_count * (i + 1) / thread_count, delta_time,
+		};
+	}
+	env_shm_store(&header->running, 1);
+	fprintf(stderr, "Serving %d environments on %s with %d threads\n", env_count, shm_name, thread_count);
+	// The calling thread is one of them
+	Job_System * jobs = jobs_create(thread_count - 1);
+	Job_Counter finished;
+	jobs_counter_init(&finished);
+	for (int i = 0; i < thread_count; i++) {
+		jobs_run(jobs, env_server_worker, &workers[i], JOB_ANY_THREAD, NULL, &finished);
+	}
+	jobs_wait(jobs, &finished);
+	jobs_destroy(jobs);
+	env_shm_store(&header->running, 0);
+
+	free(workers);
+	for (int e = 0; e < env_count; e++) {
+		for (int t = 0; t < UI_TABLE_COUNT; t++) {
+			sb_free(envs[e].state.table_orders[t]);
+		}
+	}
+	free(envs);
+	munmap(header, size);
+	shm_unlink(shm_name);
+	return 0;
+}
+#endif
+// //
+
+uint32_t overdraw_heat_color(int count)
+{
+	// ARGB: black, blue, green, yellow, orange, red, then white for 6+
+	static const uint32_t palette[] = {
+		0xff000000, 0xff0000c0, 0xff00c000, 0xffe0e000,
+		0xffff8000, 0xffff0000, 0xffffffff,
 	};
-} Game_State;
+	int max = sizeof(palette) / sizeof(palette[0]) - 1;
+	return palette[count > max ? max : count];
+}
 
-int main()
+// Replaces the finished frame with the heatmap and resets the counters
+void overdraw_render(Engine * engine)
 {
-	difficulty = 0.5;
-	srand(time(0));
-	SDL_Init(SDL_INIT_VIDEO);
+	Overdraw_State * overdraw = engine->overdraw;
+	if (!overdraw->texture) {
+		overdraw->texture = SDL_CreateTexture(engine->sdl.renderer, SDL_PIXELFORMAT_ARGB8888,
+											  SDL_TEXTUREACCESS_STREAMING,
+											  SCREEN_WIDTH, SCREEN_HEIGHT);
+	}
+	uint64_t total = 0;
+	int max = 0;
+	for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+		int count = overdraw->counts[i];
+		total += count;
+		if (count > max) max = count;
+		overdraw->heat[i] = overdraw_heat_color(count);
+	}
+	SDL_UpdateTexture(overdraw->texture, NULL, overdraw->heat, SCREEN_WIDTH * 4);
+	SDL_RenderCopy(engine->sdl.renderer, overdraw->texture, NULL, NULL);
+	{
+		char buffer[512];
+		sprintf(buffer, "avg %.2f  max %d", (float) total / (SCREEN_WIDTH * SCREEN_HEIGHT), max);
+		int w, h;
+		SDL_Texture * texture = render_text(engine, buffer, (SDL_Color) { 0xff, 0xff, 0xff, 0xff }, &w, &h);
+		SDL_Rect rect = (SDL_Rect) { DEATH_TEXT_X, DEATH_TEXT_Y, w, h };
+		SDL_RenderCopy(engine->sdl.renderer, texture, NULL, &rect);
+		SDL_DestroyTexture(texture);
+	}
+	memset(overdraw->counts, 0, sizeof(overdraw->counts));
+}
 
-	TTF_Init();
-	default_font = TTF_OpenFont("resources/EBGaramond12-AllSC.ttf", UI_FONT_SIZE);
+// Built without main() as a shared library for env.h users
+#ifndef LD43_LIBRARY
+void print_usage(char * program)
+{
+	fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  --headless <frames>  render <frames> frames without a window or audio\n"
+			"  --pipelined          simulate play on its own thread at a fixed tick\n"
+			"  --out <file.bmp>     save the last headless frame\n"
+			"  --record <pattern>   record every played session, %%d is the session number\n"
+			"  --fixed              play on integer time, the same on every machine\n"
+			"  --time-scale <x>     game seconds per real second, F2 / F3 / F4 halve,\n"
+			"                       double and reset it\n"
+			"  --latency            time clicks to the present that shows them\n"
+			"  --jit                start each frame just in time for the next refresh\n"
+			"  --render-scale <s>   draw at s times the layout size, or \"native\" for the\n"
+			"                       window's, and stretch to a resizable window\n"
+			"  --render-filter <f>  nearest, linear or best for the stretch\n"
+			"  --render-budget <ms> move the render scale to keep frames under ms\n"
+			"  --renderer <name>    use this SDL render driver instead of the fastest\n"
+			"  --probe-renderer     time every render driver again, see " RENDERER_CACHE_PATH "\n"
+			"  --export <session>   render a recorded session to --out, which is a\n"
+			"                       .y4m file or a BMP pattern like frames/%%06d.bmp\n"
+			"  --jobs <n>           processes to split --export across\n"
+			"  --render-bench <goldens>  hash and time a fixed set of scenes offscreen\n"
+			"  --update-goldens     write the --render-bench hashes instead of checking\n"
+			"  --iterations <n>     timed renders per scene for --render-bench\n"
+			"  --tune ...           simulate bot sessions over a spawn parameter grid,\n"
+			"                       see --tune --help\n"
+			"  --solve ...          search for the longest survival of a seed,\n"
+			"                       see --solve --help\n"
+			"  --env-bench <envs> <steps>  step batched environments with random actions\n"
+			"  --env-server <name> ...  serve environments over shared memory,\n"
+			"                       see --env-server --help\n",
+			program);
+}
 
-	Mix_Init(MIX_INIT_OGG);
-	Mix_OpenAudio(MIX_DEFAULT_FREQUENCY, MIX_DEFAULT_FORMAT, 2, 1024);
-	sound_init();
-
-	sdl_state.last_count = SDL_GetPerformanceCounter();
-	SDL_Window * window = SDL_CreateWindow(
-		"LD43",
-		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-		SCREEN_WIDTH, SCREEN_HEIGHT,
-		SDL_WINDOW_SHOWN);
-	SDL_Renderer * renderer = SDL_CreateRenderer(window, -1, 0);
-	sdl_state.renderer = renderer;
-	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+int main(int argc, char ** argv)
+{
+	int headless_frames = 0;
+	bool fixed_point = false;
+	float time_scale = 1.0;
+	char * out_path = NULL;
+	char * export_path = NULL;
+	int jobs = 1;
+	char * goldens_path = NULL;
+	bool update_goldens = false;
+	int iterations = BENCH_ITERATIONS;
+	bool pipelined = false;
+	bool jit = false;
+	Render_Scale render_scale;
+	render_scale_init(&render_scale);
+	char * renderer_name = NULL;
+	bool renderer_probe_again = false;
+	if (argc > 1 && strcmp(argv[1], "--tune") == 0) {
+		return tuner_main(argc, argv);
+	}
+	if (argc > 1 && strcmp(argv[1], "--solve") == 0) {
+		return solver_main(argc, argv);
+	}
+	if (argc > 3 && strcmp(argv[1], "--env-bench") == 0) {
+		return env_bench(atoi(argv[2]), atoi(argv[3]));
+	}
+	if (argc > 1 && strcmp(argv[1], "--env-server") == 0) {
+#ifndef _WIN32
+		return env_server_main(argc, argv);
+#else
+		fprintf(stderr, "--env-server needs POSIX shared memory\n");
+		return 1;
+#endif
+	}
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+			headless_frames = atoi(argv[++i]);
+			// 0 would mean a window
+			if (headless_frames < 1) {
+				print_usage(argv[0]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--pipelined") == 0) {
+			pipelined = true;
+		} else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+			out_path = argv[++i];
+		} else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			session_recorder.path = argv[++i];
+		} else if (strcmp(argv[i], "--fixed") == 0) {
+			fixed_point = true;
+		} else if (strcmp(argv[i], "--latency") == 0) {
+			latency_enable();
+		} else if (strcmp(argv[i], "--jit") == 0) {
+			jit = true;
+		} else if (strcmp(argv[i], "--render-scale") == 0 && i + 1 < argc) {
+			render_scale.enabled = true;
+			if (strcmp(argv[++i], "native") == 0) {
+				render_scale.native = true;
+			} else {
+				render_scale.scale = SDL_min(SDL_max(atof(argv[i]), RENDER_SCALE_MIN), RENDER_SCALE_MAX);
+			}
+		} else if (strcmp(argv[i], "--renderer") == 0 && i + 1 < argc) {
+			renderer_name = argv[++i];
+		} else if (strcmp(argv[i], "--probe-renderer") == 0) {
+			renderer_probe_again = true;
+		} else if (strcmp(argv[i], "--render-filter") == 0 && i + 1 < argc) {
+			render_scale.filter = argv[++i];
+		} else if (strcmp(argv[i], "--render-budget") == 0 && i + 1 < argc) {
+			render_scale.budget = atof(argv[++i]) / 1000.0;
+			if (!render_scale.enabled) {
+				render_scale.enabled = true;
+				render_scale.native = true;
+			}
+		} else if (strcmp(argv[i], "--time-scale") == 0 && i + 1 < argc) {
+			time_scale = SDL_min(SDL_max(atof(argv[++i]), TIME_SCALE_MIN), TIME_SCALE_MAX);
+		} else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+			export_path = argv[++i];
+		} else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+			jobs = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--render-bench") == 0 && i + 1 < argc) {
+			goldens_path = argv[++i];
+		} else if (strcmp(argv[i], "--update-goldens") == 0) {
+			update_goldens = true;
+		} else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+			iterations = atoi(argv[++i]);
+		} else {
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (export_path) {
+		if (!out_path) {
+			print_usage(argv[0]);
+			return 1;
+		}
+		return export_session(export_path, out_path, jobs);
+	}
+	if (goldens_path) {
+		return render_bench(goldens_path, update_goldens, iterations > 0 ? iterations : 1);
+	}
+	bool headless = headless_frames > 0;
+	// Headless frames are always the layout size
+	render_scale.enabled &= !headless;
 
-	Game_State ** game_state_stack = NULL;
+	Engine engine;
+	engine_init(&engine);
+	engine.fixed_point = fixed_point;
+	engine.time_scale = time_scale;
+	engine.jobs = jobs_create(-1);
 
-	{
-		Game_State * gs = (Game_State*) malloc(sizeof(Game_State));
-		gs->type = STATE_MAIN_MENU;
-		sb_push(game_state_stack, gs);
+	engine.sdl.last_count = SDL_GetPerformanceCounter();
+	if (headless) {
+		if (!headless_init(&engine)) {
+			return 1;
+		}
+	} else {
+		// Window first, so something is on screen before any loading
+		SDL_Init(SDL_INIT_VIDEO);
+
+		SDL_Window * window = SDL_CreateWindow(
+			"LD43",
+			SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+			SCREEN_WIDTH, SCREEN_HEIGHT,
+			SDL_WINDOW_SHOWN | (render_scale.enabled ? SDL_WINDOW_RESIZABLE : 0));
+		engine.sdl.window = window;
+		// Render scale draws through a target texture
+		uint32_t required = render_scale.enabled ? SDL_RENDERER_TARGETTEXTURE : 0;
+		// The pacer times frames to the refresh the present waits for
+		uint32_t flags = jit ? SDL_RENDERER_PRESENTVSYNC : 0;
+		engine.sdl.renderer = renderer_create(window, renderer_name, renderer_probe_again, required, flags);
+		SDL_RendererInfo info;
+		if (jit && SDL_GetRendererInfo(engine.sdl.renderer, &info) == 0 &&
+			!(info.flags & SDL_RENDERER_PRESENTVSYNC)) {
+			fprintf(stderr, "Renderer %s has no vsync, --jit only caps the frame rate\n", info.name);
+		}
+		render_scale_attach(&render_scale, engine.sdl.renderer);
+		SDL_SetRenderDrawBlendMode(engine.sdl.renderer, SDL_BLENDMODE_BLEND);
+		SDL_SetRenderDrawColor(engine.sdl.renderer, 0x00, 0x00, 0x00, 0xff);
+		SDL_RenderClear(engine.sdl.renderer);
+		SDL_RenderPresent(engine.sdl.renderer);
+
+		TTF_Init();
+	}
+	SDL_Renderer * renderer = engine.sdl.renderer;
+	input_filter_install();
+	Frame_Pacer pacer;
+	pacer_init(&pacer, jit && !headless, engine.sdl.window);
+
+	// Both screens live for the whole run, so their textures can stream
+	// in ahead of time
+	Game_State * main_menu_state = (Game_State*) malloc(sizeof(Game_State));
+	main_menu_state->type = STATE_MAIN_MENU;
+	main_menu_state->resident = false;
+	Game_State * playing_state = (Game_State*) calloc(1, sizeof(Game_State));
+	playing_state->type = STATE_PLAYING;
+	playing_state->resident = false;
+
+	Rewind_Ring * rewind = rewind_create();
+
+	Asset_Stream assets;
+	assets_start(&assets, &engine, &main_menu_state->state_main_menu,
+				 &playing_state->state_playing, !headless);
+	if (headless) {
+		// Frames have to come out the same every run
+		assets_finish(&assets);
 	}
 
+	Game_State ** game_state_stack = NULL;
+	sb_push(game_state_stack, main_menu_state);
+
 	bool new_frame = true;
+	uint64_t last_draw = 0;
+
+	Pipeline pipeline;
+	memset(&pipeline, 0, sizeof(pipeline));
+	SDL_Event * frame_events = NULL;
 	
 	SDL_Event event;
 	bool running = true;
@@ -907,28 +5270,72 @@ int main()
 		if (new_frame) {
 			new_frame = false;
 			switch (game_state->type) {
-			case STATE_PLAYING:
-				state_playing_init(&(game_state->state_playing));
-				break;
+			case STATE_PLAYING: {
+				input_want(PLAYING_INPUT);
+				assets_wait(&assets, ASSETS_PLAYING);
+				uint32_t seed = (uint32_t) SDL_GetPerformanceCounter() ^ (uint32_t) time(0);
+				state_playing_init(&engine, &(game_state->state_playing), seed);
+				rewind_clear(rewind);
+				latency_begin();
+				session_record_begin(&engine, seed);
+				if (pipelined) {
+					// The simulation thread plays sounds from its own copy of
+					// the engine, which has to be taken with audio enabled
+					assets_wait(&assets, ASSETS_AUDIO);
+					pipeline_start(&pipeline, &engine, &(game_state->state_playing), rewind);
+				}
+			} break;
 			case STATE_MAIN_MENU:
-				state_main_menu_init(&(game_state->state_main_menu));
+				input_want(MAIN_MENU_INPUT);
+				if (game_state->resident) {
+					state_main_menu_resume(&engine, &(game_state->state_main_menu));
+				} else {
+					state_main_menu_init(&engine, &(game_state->state_main_menu));
+				}
 				break;
 			default:
 				assert(false);
 				break;
 			}
+			game_state->resident = true;
+		}
+
+		// An idle menu sleeps until something happens, and is only drawn
+		// again if something did
+		bool menu_idle = !headless && game_state->type == STATE_MAIN_MENU &&
+			assets_ready(&assets, ASSETS_AUDIO) && state_main_menu_idle(&game_state->state_main_menu);
+		if (menu_idle) {
+			SDL_WaitEventTimeout(NULL, MENU_IDLE_TIMEOUT_MS);
+			// The wait isn't frame time
+			engine.sdl.last_count = SDL_GetPerformanceCounter();
+		} else if (!time_scale_turbo(&engine)) {
+			pacer_wait(&pacer);
 		}
 
+		int polled = 0;
 		while (SDL_PollEvent(&event) != 0) {
+			polled++;
+			input_dequeued(event);
 			if (event.type == SDL_QUIT) {
 				running = false;
-			} else {
+			} else if (event.type == SDL_KEYDOWN &&
+					   event.key.keysym.scancode == OVERDRAW_TOGGLE_KEY) {
+				overdraw_toggle(&engine);
+			} else if (!time_scale_event(&engine, event)) {
 				switch (game_state->type) {
 				case STATE_PLAYING:
-					state_playing_event(&(game_state->state_playing), event);
+					latency_input(event);
+					if (pipelined) {
+						sb_push(frame_events, event);
+						break;
+					}
+					session_record_event(event);
+					state_playing_event(&engine, &(game_state->state_playing), event);
 					break;
 				case STATE_MAIN_MENU:
-					state_main_menu_event(&(game_state->state_main_menu), event);
+					if (assets_ready(&assets, ASSETS_MENU)) {
+						state_main_menu_event(&engine, &(game_state->state_main_menu), event);
+					}
 					break;
 				default:
 					assert(false);
@@ -937,34 +5344,87 @@ int main()
 			}
 		}
 
-		SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xff);
-		SDL_RenderClear(renderer);
-		
+		jobs_run_main(engine.jobs);
+
+		SDL_GetMouseState(&engine.sdl.mouse_x, &engine.sdl.mouse_y);
+		render_scale_mouse(&render_scale, renderer, &engine.sdl.mouse_x, &engine.sdl.mouse_y);
+		if (pipeline.thread) {
+			pipeline_push(&pipeline, frame_events, engine.sdl.mouse_x, engine.sdl.mouse_y, engine.time_scale);
+		}
+		if (frame_events) {
+			stb__sbn(frame_events) = 0;
+		}
+
+		// In turbo most frames only simulate, and an idle menu without
+		// events isn't drawn at all
+		bool draw = true;
+		if (!headless && game_state->type == STATE_PLAYING && time_scale_turbo(&engine)) {
+			uint64_t now = SDL_GetPerformanceCounter();
+			draw = now - last_draw >= SDL_GetPerformanceFrequency() / TURBO_RENDER_FPS;
+		}
+		if (menu_idle && polled == 0) {
+			draw = false;
+		}
+		if (draw) {
+			last_draw = SDL_GetPerformanceCounter();
+			render_scale_begin(&render_scale, renderer);
+			SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xff);
+			render_clear(&engine);
+		}
+
 		switch (sb_last(game_state_stack)->type) {
 		case STATE_PLAYING: {
-			Playing_Msg msg = state_playing_update(&(game_state->state_playing));
+			Playing_Msg msg;
+			if (pipelined) {
+				msg = pipeline_finished(&pipeline);
+			} else {
+				msg = state_playing_advance(&engine, &(game_state->state_playing), rewind, engine.sdl.delta_time);
+			}
 			switch (msg) {
 			case PLAYING_OK:
-				state_playing_render(&(game_state->state_playing));
+			// Already handled by state_playing_step
+			case PLAYING_REWIND:
+				if (!draw) break;
+				if (pipelined) {
+					pipeline_render(&engine, &pipeline);
+				} else {
+					state_playing_render(&engine, &(game_state->state_playing));
+				}
 				break;
 			case PLAYING_LOST:
+				pipeline_stop(&pipeline);
+				session_record_end();
+				// The death screen may never have been drawn in turbo
+				cursor_show(&engine, NULL);
 				sb_pop(game_state_stack);
 				new_frame = true;
 				break;
+			case PLAYING_RETRY:
+				// Entering again only resets it, textures are kept
+				pipeline_stop(&pipeline);
+				session_record_end();
+				cursor_show(&engine, NULL);
+				new_frame = true;
+				break;
 			}
 		} break;
 		case STATE_MAIN_MENU: {
-			Main_Menu_Msg msg = state_main_menu_update(&(game_state->state_main_menu));
+			if (!assets_ready(&assets, ASSETS_MENU)) {
+				// Stay black until the menu can be drawn
+				break;
+			}
+			Main_Menu_Msg msg = state_main_menu_update(&engine, &(game_state->state_main_menu));
 			switch (msg) {
 			case MAIN_MENU_NOTHING:
-				state_main_menu_render(&(game_state->state_main_menu));
+				if (draw) {
+					state_main_menu_render(&engine, &(game_state->state_main_menu));
+				}
 				break;
-			case MAIN_MENU_PLAY: {
-				Game_State * gs = (Game_State*) malloc(sizeof(Game_State));
-				gs->type = STATE_PLAYING;
-				sb_push(game_state_stack, gs);
+			case MAIN_MENU_PLAY:
+				state_main_menu_suspend(&engine, &(game_state->state_main_menu));
+				sb_push(game_state_stack, playing_state);
 				new_frame = true;
-			} break;
+				break;
 			case MAIN_MENU_QUIT:
 				sb_pop(game_state_stack);
 				new_frame = true;
@@ -976,16 +5436,48 @@ int main()
 			break;
 		}
 
-		//printf("%f\r", difficulty);
+		//printf("%f\r", engine.difficulty);
 		//fflush(stdout);
-							   
-		SDL_RenderPresent(renderer);
+
+		if (draw) {
+			if (overdraw_enabled(&engine)) {
+				overdraw_render(&engine);
+			}
+			render_scale_end(&render_scale, renderer);
+			render_scale_rendered(&render_scale);
+			pacer_rendered(&pacer);
+			SDL_RenderPresent(renderer);
+			pacer_presented(&pacer);
+			latency_presented();
+		}
+
+		if (headless) {
+			if (--headless_frames == 0) {
+				running = false;
+			}
+			continue;
+		}
 		
 		uint64_t frame_end = SDL_GetPerformanceCounter();
-		sdl_state.delta_time =
-			(float) (frame_end - sdl_state.last_count) / SDL_GetPerformanceFrequency();
-		sdl_state.last_count = frame_end;
+		engine.sdl.delta_time =
+			(float) (frame_end - engine.sdl.last_count) / SDL_GetPerformanceFrequency();
+		engine.sdl.last_count = frame_end;
+	}
+
+	pipeline_stop(&pipeline);
+	rewind_free(rewind);
+	latency_report();
+	assets_finish(&assets);
+	state_playing_free_cursors(&engine, &playing_state->state_playing);
+	jobs_destroy(engine.jobs);
+
+	if (headless && out_path) {
+		if (SDL_SaveBMP(engine.sdl.frame, out_path) != 0) {
+			fprintf(stderr, "Could not save %s: %s\n", out_path, SDL_GetError());
+			return 1;
+		}
 	}
 	
 	return 0;
 }
+#endif
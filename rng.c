@@ -0,0 +1,58 @@
+#include "rng.h"
+
+static uint64_t splitmix64(uint64_t * x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+void rng_seed(Rng * rng, uint64_t seed, uint64_t stream)
+{
+	uint64_t x = seed ^ (stream * 0xd1b54a32d192ed03);
+	// Burn one output so nearby seeds and streams diverge immediately
+	splitmix64(&x);
+	for (int i = 0; i < 4; i++) {
+		rng->s[i] = splitmix64(&x);
+	}
+}
+
+uint64_t rng_next(Rng * rng)
+{
+	uint64_t * s = rng->s;
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+// Lemire's multiply-shift with rejection, so there is no modulo bias
+uint32_t rng_range(Rng * rng, uint32_t n)
+{
+	uint64_t m = (rng_next(rng) >> 32) * n;
+	uint32_t low = (uint32_t) m;
+	if (low < n) {
+		uint32_t threshold = -n % n;
+		while (low < threshold) {
+			m = (rng_next(rng) >> 32) * n;
+			low = (uint32_t) m;
+		}
+	}
+	return (uint32_t) (m >> 32);
+}
+
+float rng_float(Rng * rng)
+{
+	return (rng_next(rng) >> 40) * (1.0f / 16777216.0f);
+}
@@ -0,0 +1,22 @@
+/* xoshiro256** by David Blackman and Sebastiano Vigna, public domain,
+ * seeded through splitmix64. See http://prng.di.unimi.it/
+ */
+
+// Every generator carries its own state, so independent streams can be
+// kept per consumer and per thread.
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+	uint64_t s[4];
+} Rng;
+
+// Different streams from the same seed are independent of each other
+void rng_seed(Rng * rng, uint64_t seed, uint64_t stream);
+uint64_t rng_next(Rng * rng);
+// Uniform in [0, n)
+uint32_t rng_range(Rng * rng, uint32_t n);
+// Uniform in [0, 1)
+float rng_float(Rng * rng);
@@ -0,0 +1,70 @@
+#include <math.h>
+#include <string.h>
+
+#include "sketch.h"
+
+#define SKETCH_GAMMA ((1.0 + SKETCH_ACCURACY) / (1.0 - SKETCH_ACCURACY))
+
+void sketch_init(Quantile_Sketch * sketch)
+{
+	memset(sketch, 0, sizeof(Quantile_Sketch));
+	sketch->min = INFINITY;
+	sketch->max = -INFINITY;
+}
+
+static int sketch_bucket(double value)
+{
+	int bucket = (int) ceil(log(value / SKETCH_MIN_VALUE) / log(SKETCH_GAMMA));
+	if (bucket < 0) bucket = 0;
+	if (bucket >= SKETCH_BUCKETS) bucket = SKETCH_BUCKETS - 1;
+	return bucket;
+}
+
+void sketch_add(Quantile_Sketch * sketch, double value)
+{
+	if (value <= SKETCH_MIN_VALUE) {
+		sketch->zero_count++;
+	} else {
+		sketch->buckets[sketch_bucket(value)]++;
+	}
+	sketch->count++;
+	sketch->sum += value;
+	if (value < sketch->min) sketch->min = value;
+	if (value > sketch->max) sketch->max = value;
+}
+
+void sketch_merge(Quantile_Sketch * into, const Quantile_Sketch * from)
+{
+	for (int i = 0; i < SKETCH_BUCKETS; i++) {
+		into->buckets[i] += from->buckets[i];
+	}
+	into->zero_count += from->zero_count;
+	into->count += from->count;
+	into->sum += from->sum;
+	if (from->min < into->min) into->min = from->min;
+	if (from->max > into->max) into->max = from->max;
+}
+
+double sketch_quantile(const Quantile_Sketch * sketch, double q)
+{
+	if (sketch->count == 0) return 0.0;
+	if (q <= 0.0) return sketch->min;
+	if (q >= 1.0) return sketch->max;
+	uint64_t rank = (uint64_t) (q * (sketch->count - 1));
+	if (rank < sketch->zero_count) return sketch->min;
+	uint64_t seen = sketch->zero_count;
+	for (int i = 0; i < SKETCH_BUCKETS; i++) {
+		seen += sketch->buckets[i];
+		if (seen > rank) {
+			// Middle of the bucket (gamma^(i-1), gamma^i] in relative terms
+			double value = SKETCH_MIN_VALUE * 2.0 * pow(SKETCH_GAMMA, i) / (SKETCH_GAMMA + 1.0);
+			return fmin(fmax(value, sketch->min), sketch->max);
+		}
+	}
+	return sketch->max;
+}
+
+double sketch_mean(const Quantile_Sketch * sketch)
+{
+	return sketch->count ? sketch->sum / sketch->count : 0.0;
+}
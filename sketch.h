@@ -0,0 +1,32 @@
+/* Streaming quantile sketch over positive values, in the style of
+ * DDSketch (Masson, Rim, Lee 2019). Values are counted in logarithmic
+ * buckets, so any reported quantile is within SKETCH_ACCURACY of the
+ * true value relative to its size. Sketches of the same kind merge by
+ * adding their buckets.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define SKETCH_ACCURACY 0.01
+// Covers SKETCH_MIN_VALUE up to around 10^6 times that
+#define SKETCH_BUCKETS   700
+#define SKETCH_MIN_VALUE 0.01
+
+typedef struct {
+	uint64_t buckets[SKETCH_BUCKETS];
+	// Values at or below SKETCH_MIN_VALUE
+	uint64_t zero_count;
+	uint64_t count;
+	double sum;
+	double min;
+	double max;
+} Quantile_Sketch;
+
+void sketch_init(Quantile_Sketch * sketch);
+void sketch_add(Quantile_Sketch * sketch, double value);
+void sketch_merge(Quantile_Sketch * into, const Quantile_Sketch * from);
+// q in [0, 1]
+double sketch_quantile(const Quantile_Sketch * sketch, double q);
+double sketch_mean(const Quantile_Sketch * sketch);
@@ -0,0 +1,224 @@
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_EXPIRED (TIMER_WHEEL_LISTS - 1)
+// Ticks covered by every level together
+#define TIMER_WHEEL_RANGE   ((uint64_t) 1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+static void list_append(Timer_Wheel * wheel, int list, int id)
+{
+	Timer * timer = &wheel->timers[id];
+	timer->list = list;
+	timer->prev = wheel->tails[list];
+	timer->next = -1;
+	if (timer->prev != -1) {
+		wheel->timers[timer->prev].next = id;
+	} else {
+		wheel->heads[list] = id;
+	}
+	wheel->tails[list] = id;
+	if (list != TIMER_WHEEL_EXPIRED) {
+		wheel->occupied[list / TIMER_WHEEL_SLOTS] |= (uint64_t) 1 << (list % TIMER_WHEEL_SLOTS);
+	}
+}
+
+static void list_remove(Timer_Wheel * wheel, int id)
+{
+	Timer * timer = &wheel->timers[id];
+	int list = timer->list;
+	if (timer->prev != -1) {
+		wheel->timers[timer->prev].next = timer->next;
+	} else {
+		wheel->heads[list] = timer->next;
+	}
+	if (timer->next != -1) {
+		wheel->timers[timer->next].prev = timer->prev;
+	} else {
+		wheel->tails[list] = timer->prev;
+	}
+	if (wheel->heads[list] == -1 && list != TIMER_WHEEL_EXPIRED) {
+		wheel->occupied[list / TIMER_WHEEL_SLOTS] &= ~((uint64_t) 1 << (list % TIMER_WHEEL_SLOTS));
+	}
+}
+
+// Where the wheel next reaches slot on level, counting from now
+static uint64_t slot_start(uint64_t now, int level, int slot)
+{
+	int shift = TIMER_WHEEL_BITS * level;
+	int turn_shift = shift + TIMER_WHEEL_BITS;
+	uint64_t start = (now >> turn_shift << turn_shift) + ((uint64_t) slot << shift);
+	if (slot <= (int) ((now >> shift) & TIMER_WHEEL_MASK)) {
+		start += (uint64_t) 1 << turn_shift;
+	}
+	return start;
+}
+
+static void timer_free(Timer_Wheel * wheel, int id)
+{
+	Timer * timer = &wheel->timers[id];
+	timer->list = -1;
+	timer->next = wheel->free;
+	wheel->free = id;
+}
+
+// The lowest level whose turn still reaches the due time
+static void timer_place(Timer_Wheel * wheel, int id)
+{
+	uint64_t due = wheel->timers[id].due;
+	uint64_t now = wheel->now;
+	if (due <= now) {
+		list_append(wheel, TIMER_WHEEL_EXPIRED, id);
+		wheel->next = now;
+		return;
+	}
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		int shift = TIMER_WHEEL_BITS * (level + 1);
+		if ((due >> shift) == (now >> shift) || level == TIMER_WHEEL_LEVELS - 1) {
+			int slot_shift = TIMER_WHEEL_BITS * level;
+			int slot = (due >> slot_shift) & TIMER_WHEEL_MASK;
+			if (due - now >= TIMER_WHEEL_RANGE) {
+				// Out of range; parks in the top slot seen last this turn
+				// and is placed again when that comes round
+				slot = ((now >> slot_shift) - 1) & TIMER_WHEEL_MASK;
+			}
+			list_append(wheel, level * TIMER_WHEEL_SLOTS + slot, id);
+			uint64_t start = slot_start(now, level, slot);
+			if (start < wheel->next) {
+				wheel->next = start;
+			}
+			return;
+		}
+	}
+}
+
+void timer_wheel_init(Timer_Wheel * wheel, uint64_t now)
+{
+	wheel->now = now;
+	timer_wheel_clear(wheel);
+}
+
+void timer_wheel_clear(Timer_Wheel * wheel)
+{
+	for (int i = 0; i < TIMER_WHEEL_LEVELS; i++) {
+		wheel->occupied[i] = 0;
+	}
+	for (int i = 0; i < TIMER_WHEEL_LISTS; i++) {
+		wheel->heads[i] = -1;
+		wheel->tails[i] = -1;
+	}
+	wheel->free = -1;
+	wheel->next = UINT64_MAX;
+	for (int i = TIMER_WHEEL_CAPACITY - 1; i >= 0; i--) {
+		timer_free(wheel, i);
+	}
+}
+
+int timer_wheel_schedule(Timer_Wheel * wheel, uint64_t delay, int kind, int arg)
+{
+	int id = wheel->free;
+	if (id == -1) return -1;
+	Timer * timer = &wheel->timers[id];
+	wheel->free = timer->next;
+	timer->due = wheel->now + delay;
+	timer->kind = kind;
+	timer->arg = arg;
+	timer_place(wheel, id);
+	return id;
+}
+
+bool timer_wheel_pending(Timer_Wheel * wheel, int timer)
+{
+	return timer >= 0 && timer < TIMER_WHEEL_CAPACITY && wheel->timers[timer].list != -1;
+}
+
+void timer_wheel_cancel(Timer_Wheel * wheel, int timer)
+{
+	if (!timer_wheel_pending(wheel, timer)) return;
+	list_remove(wheel, timer);
+	timer_free(wheel, timer);
+}
+
+uint64_t timer_wheel_remaining(Timer_Wheel * wheel, int timer)
+{
+	if (!timer_wheel_pending(wheel, timer)) return 0;
+	uint64_t due = wheel->timers[timer].due;
+	return due > wheel->now ? due - wheel->now : 0;
+}
+
+// Timers are freed before their callback runs, so a callback can
+// schedule itself again
+static void list_fire(Timer_Wheel * wheel, int list, const Timer_Callback * callbacks, void * context)
+{
+	int id;
+	while ((id = wheel->heads[list]) != -1) {
+		Timer * timer = &wheel->timers[id];
+		int kind = timer->kind;
+		int arg = timer->arg;
+		list_remove(wheel, id);
+		timer_free(wheel, id);
+		callbacks[kind](context, arg);
+	}
+}
+
+// Called when level 0 starts a new turn. Each level above whose slot
+// just came round hands its timers down.
+static void wheel_cascade(Timer_Wheel * wheel)
+{
+	for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		int slot = (wheel->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+		int list = level * TIMER_WHEEL_SLOTS + slot;
+		int id;
+		while ((id = wheel->heads[list]) != -1) {
+			list_remove(wheel, id);
+			timer_place(wheel, id);
+		}
+		if (slot != 0) break;
+	}
+}
+
+// The start of the earliest slot with timers in it on any level; where
+// the next timer fires or moves down a level. Below the top level every
+// occupied slot is ahead of the wheel in the current turn, so the first
+// level with any timers has the earliest one.
+static uint64_t wheel_next(Timer_Wheel * wheel)
+{
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		uint64_t occupied = wheel->occupied[level];
+		if (!occupied) continue;
+		int from = ((wheel->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK) + 1;
+		uint64_t ahead = from < TIMER_WHEEL_SLOTS ? occupied >> from << from : 0;
+		// Only parked timers on the top level can be behind
+		return slot_start(wheel->now, level, __builtin_ctzll(ahead ? ahead : occupied));
+	}
+	return UINT64_MAX;
+}
+
+void timer_wheel_advance(Timer_Wheel * wheel, uint64_t now,
+						 const Timer_Callback * callbacks, void * context)
+{
+	// Nothing due or moving down before now
+	if (now < wheel->next) {
+		if (now > wheel->now) {
+			wheel->now = now;
+		}
+		return;
+	}
+	list_fire(wheel, TIMER_WHEEL_EXPIRED, callbacks, context);
+	for (;;) {
+		uint64_t next = wheel_next(wheel);
+		if (next > now) {
+			// Still the earliest slot once the wheel has moved up to now
+			if (now > wheel->now) {
+				wheel->now = now;
+			}
+			wheel->next = next;
+			return;
+		}
+		wheel->now = next;
+		if ((next & TIMER_WHEEL_MASK) == 0) {
+			wheel_cascade(wheel);
+		}
+		list_fire(wheel, next & TIMER_WHEEL_MASK, callbacks, context);
+		list_fire(wheel, TIMER_WHEEL_EXPIRED, callbacks, context);
+	}
+}
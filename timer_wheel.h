@@ -0,0 +1,69 @@
+/* Hierarchical timer wheel, after Varghese and Lauck (1987)
+ *
+ * Timers hang off TIMER_WHEEL_LEVELS wheels of TIMER_WHEEL_SLOTS slots.
+ * A level 0 slot is one tick, and a slot on any other level spans a
+ * whole turn of the level below it. Timers that are further off wait
+ * in a coarse slot. Each time the level below comes round to them, they
+ * drop down a level. Scheduling and cancelling are O(1). Advancing
+ * jumps straight to the next slot that holds timers, on any level, so
+ * its cost follows the timers that fire and not the ones that wait or
+ * the time skipped.
+ *
+ * The wheel is plain data with no pointers in it. Timers are addressed
+ * by index and carry a kind, an index into the callback table passed
+ * to timer_wheel_advance, so a wheel can be copied or saved as bytes
+ * along with whatever it is embedded in.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_BITS     6
+#define TIMER_WHEEL_SLOTS    (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS   4
+// At most 127
+#define TIMER_WHEEL_CAPACITY 32
+// One list per slot, plus one for timers already due
+#define TIMER_WHEEL_LISTS    (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS + 1)
+
+// context is whatever was passed to timer_wheel_advance
+typedef void (*Timer_Callback)(void * context, int arg);
+
+typedef struct {
+	uint64_t due;
+	int32_t arg;
+	int16_t kind;
+	// List the timer is on, -1 when free
+	int16_t list;
+	int8_t prev;
+	int8_t next;
+} Timer;
+
+typedef struct {
+	uint64_t now;
+	// No slot holds timers before this, so advancing short of it is free
+	uint64_t next;
+	// Bit per non-empty slot, per level
+	uint64_t occupied[TIMER_WHEEL_LEVELS];
+	int8_t heads[TIMER_WHEEL_LISTS];
+	int8_t tails[TIMER_WHEEL_LISTS];
+	int8_t free;
+	Timer timers[TIMER_WHEEL_CAPACITY];
+} Timer_Wheel;
+
+void timer_wheel_init(Timer_Wheel * wheel, uint64_t now);
+// Drops every timer, keeping the time
+void timer_wheel_clear(Timer_Wheel * wheel);
+// Fires callbacks[kind](context, arg) from the first advance that
+// reaches now + delay. Returns the timer, or -1 when the wheel is full.
+int timer_wheel_schedule(Timer_Wheel * wheel, uint64_t delay, int kind, int arg);
+void timer_wheel_cancel(Timer_Wheel * wheel, int timer);
+bool timer_wheel_pending(Timer_Wheel * wheel, int timer);
+// Ticks until the timer fires, 0 when it is due or not scheduled
+uint64_t timer_wheel_remaining(Timer_Wheel * wheel, int timer);
+// Moves time forward to now, firing everything due on the way in due
+// order. Callbacks may schedule and cancel timers.
+void timer_wheel_advance(Timer_Wheel * wheel, uint64_t now,
+						 const Timer_Callback * callbacks, void * context);